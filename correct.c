@@ -4,6 +4,10 @@
 #include <unistd.h>
 #include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 /****************************
  *** Hard coded constants ***
@@ -41,6 +45,10 @@ typedef struct {
 	int max_dist4;
 	int drop_reads;
 	int64_t batch_size;
+	int task_depth;
+	int sdict, bloom;
+	int reorder;
+	int beam, show_search;
 } fmc_opt_t;
 
 void fmc_opt_init(fmc_opt_t *opt)
@@ -63,6 +71,7 @@ void fmc_opt_init(fmc_opt_t *opt)
 	opt->max_penalty_diff = 60;
 	opt->batch_size = (1ULL<<28) - (1ULL<<20);
 	opt->max_dist4 = 8;
+	opt->task_depth = 6;
 }
 
 void kt_for(int n_threads, void (*func)(void*,long,int), void *shared, long n_items);
@@ -131,6 +140,7 @@ uint8_t *fmc_precal_qtab(int max, double e1, double e2, double a1, double a2, do
 
 #include "kvec.h"
 #include "khash.h"
+#include "rld0.h"
 
 #define fmc_cell_get_key(x) ((x)>>28)
 #define fmc_cell_get_val(x, is_right) ((x)>>((is_right)?14:0)&0x3fff)
@@ -163,35 +173,151 @@ static inline uint64_t hash_64(uint64_t key)
 KHASH_INIT(fmc, uint64_t, char, 0, fmc_hash_func, fmc_eq_func)
 
 typedef khash_t(fmc) fmc_hash_t;
-typedef kvec_t(uint64_t) fmc64_v;
+
+#define FMC_SDICT_BKT 64 // minimum average bytes per bucket; a bucket takes 64-128 bytes, one or two cache lines
+
+typedef struct { // static dictionary: sorted cells with the high key bits replaced by a bucket index
+	uint32_t n; // number of entries
+	int b_bits, lo_bits, w; // bits of the bucket index, bits of the key kept in an entry, bytes per entry
+	uint32_t *bkt; // bkt[j] is the first entry in bucket j; (1<<b_bits)+1 elements
+	uint8_t *ent; // entry: (key&lo_mask)<<28 | val, in w bytes; padded by 8 bytes at the end
+} fmc_sdict_t;
+
+#define FMC_BLOOM_BITS 12 // bits per k-mer
+#define FMC_BLOOM_K    6  // probes per k-mer, all in one 512-bit block
+
+typedef struct { // blocked Bloom filter
+	uint32_t n_blk;
+	uint64_t *b; // n_blk blocks of 8 words, aligned to 64 bytes
+} fmc_bloom_t;
+
+#define FMC_DIRECT_PRE 8 // bi-intervals of all 8-mers are precomputed in the table-free mode
+
+typedef struct { // table-free mode (correct -I): k-mers are looked up in the FMD-index on demand
+	rld_t *e;
+	rldintv_t *pre; // bi-intervals of all pre_len-mers, indexed as in fmc_traverse()
+	int pre_len, min_occ;
+	uint8_t *qtab[2];
+	fmc_collect_opt_t c;
+} fmc_direct_t;
 
 typedef struct {
-	uint64_t suf:63, missing:1;
-	uint64_t x;
-} longcell_t;
+	int n; // number of partitions, 1<<suf_len*2
+	fmc_direct_t *dr; // non-NULL in the table-free mode, where n=0
+	fmc_hash_t **h; // hash tables, or
+	fmc_sdict_t *d; // static dictionaries (correct -S)
+	fmc_bloom_t *bf; // optional prefilter (correct -B)
+	uint8_t *map; // non-NULL if h[], d[] or bf[] points into a read-only mmap()'d table
+	size_t l_map;
+} fmc_tab_t;
+
+static inline uint64_t *fmc_bloom_blk(const fmc_bloom_t *f, uint64_t key, uint64_t *g)
+{
+	uint64_t h = hash_64(key);
+	*g = hash_64(h); // for the probes
+	return &f->b[(h >> 32) * f->n_blk >> 32 << 3];
+}
+
+static inline void fmc_bloom_put(fmc_bloom_t *f, uint64_t key)
+{
+	uint64_t g, *b = fmc_bloom_blk(f, key, &g);
+	int j;
+	for (j = 0; j < FMC_BLOOM_K; ++j, g >>= 9)
+		b[g>>6&7] |= 1ULL << (g&63);
+}
+
+static inline int fmc_bloom_test(const fmc_bloom_t *f, uint64_t key)
+{
+	uint64_t g, *b = fmc_bloom_blk(f, key, &g);
+	int j;
+	for (j = 0; j < FMC_BLOOM_K; ++j, g >>= 9)
+		if ((b[g>>6&7] >> (g&63) & 1) == 0) return 0;
+	return 1;
+}
+
+static inline int fmc_sdict_get(const fmc_sdict_t *d, uint64_t key, uint64_t *x)
+{
+	uint32_t i, j = key >> d->lo_bits;
+	uint64_t lo = key & ((1ULL<<d->lo_bits) - 1), mask = d->w == 8? (uint64_t)-1 : (1ULL<<(d->w<<3)) - 1;
+	const uint8_t *p = d->ent + (size_t)d->bkt[j] * d->w;
+	for (i = d->bkt[j]; i < d->bkt[j+1]; ++i, p += d->w) { // a bucket spans one or two cache lines on average
+		uint64_t y;
+		memcpy(&y, p, 8); // assumes little-endian: the entry is in the low w bytes; ent[] is padded for the overread
+		y &= mask;
+		if (y>>28 < lo) continue;
+		if (y>>28 > lo) break;
+		*x = key<<28 | (y & 0xfffffff);
+		return 1;
+	}
+	return 0;
+}
+
+static inline int fmc_tab_get(const fmc_tab_t *t, int suf, uint64_t x, uint64_t *y) // look up the key of cell x
+{
+	khint_t k;
+	if (t->bf && !fmc_bloom_test(&t->bf[suf], fmc_cell_get_key(x))) return 0; // most erroneous k-mers stop here
+	if (t->d) return fmc_sdict_get(&t->d[suf], fmc_cell_get_key(x), y);
+	k = kh_get(fmc, t->h[suf], x);
+	if (k == kh_end(t->h[suf])) return 0;
+	*y = kh_key(t->h[suf], k);
+	return 1;
+}
+
+static inline void fmc_tab_prefetch(const fmc_tab_t *t, int suf, uint64_t key) // touch the memory fmc_tab_get() will read
+{
+	if (t->bf) {
+		uint64_t g;
+		__builtin_prefetch(fmc_bloom_blk(&t->bf[suf], key, &g));
+	}
+	if (t->d) {
+		const fmc_sdict_t *d = &t->d[suf];
+		uint32_t j = key >> d->lo_bits;
+		__builtin_prefetch(&d->bkt[j]);
+		__builtin_prefetch(d->ent + ((uint64_t)j * d->n >> d->b_bits) * d->w); // buckets are nearly even
+	} else if (t->h[suf]->n_buckets) {
+		const fmc_hash_t *h = t->h[suf];
+		khint_t i = hash_64(key) & (h->n_buckets - 1);
+		__builtin_prefetch(&h->keys[i]);
+		__builtin_prefetch(&h->flags[i>>4]);
+	}
+}
+typedef kvec_t(uint64_t) fmc64_v;
 
-#define fmc_longcell_get_key(a) ((a).suf<<36 | fmc_cell_get_key((a).x))
-#define fmc_hash_func_long(a) hash_64(fmc_longcell_get_key(a))
-#define fmc_eq_func_long(a, b) (fmc_longcell_get_key(a) == fmc_longcell_get_key(b))
-KHASH_INIT(kache, longcell_t, char, 0, fmc_hash_func_long, fmc_eq_func_long)
+typedef struct { // cells of solid k-mers, one list per partition
+	int n;         // number of partitions: 4^suf_len
+	fmc64_v *a;    // a[i].n is always set; a[i].a is NULL until fmc_kmer_load() if fd >= 0
+	int fd;        // k-mer list to load partitions from; -1 if all are in memory
+	uint64_t *off; // file offset of each partition
+} fmc_kmer_t;
 
-typedef khash_t(kache) kmercache_t;
+#define FMC_CACHE_BITS    14
+#define FMC_CACHE_MISSING 0xffffffffU
+
+typedef struct {
+	uint64_t key; // canonical k-mer with bit 63 set; 0 for an empty slot
+	uint32_t val; // the 28-bit value of the cell, or FMC_CACHE_MISSING
+} fmc_cache1_t;
+
+typedef struct { // direct-mapped per-thread cache of k-mer lookups
+	fmc_cache1_t *a; // 1<<FMC_CACHE_BITS slots
+	uint64_t n_hit, n_miss;
+} kmercache_t;
 
 /*********************************
  *** Collect k-mer information ***
  *********************************/
 
-#include "rld0.h"
-
 typedef kvec_t(rldintv_t) rldintv_v;
 
+#define FMC_MAX_TASK_DEPTH 10 // fmc_traverse() keeps 4^depth intervals; 32MB at 10
+
 rldintv_t *fmc_traverse(const rld_t *e, int depth) // traverse FM-index up to $depth
 {
 	rldintv_v stack = {0,0,0};
 	rldintv_t *p, *ret;
 	uint64_t x;
 
-	ret = calloc(1<<depth*2, sizeof(rldintv_t));
+	ret = calloc((size_t)1<<depth*2, sizeof(rldintv_t));
 	kv_pushp(rldintv_t, stack, &p);
 	p->x[0] = p->x[1] = 0, p->x[2] = e->mcnt[0], p->info = 0;
 	x = 0;
@@ -245,13 +371,13 @@ int fmc_intv2tip(uint8_t *qtab[2], const rldintv_t t[6], int max_ec_depth, int q
 	return fmc_cell_set_val(4-max_c, 4-max_c2, q1, q2);
 }
 
-void fmc_collect1(const rld_t *e, uint8_t *qtab[2], int suf_len, int depth, int min_occ, int max_ec_depth, int q1_depth, const rldintv_t *start, fmc64_v *a)
-{
+void fmc_collect1(const rld_t *e, uint8_t *qtab[2], int suf_len, int pre_len, int depth, int min_occ, int max_ec_depth, int q1_depth, const rldintv_t *start, fmc64_v *a)
+{ // start->info is the index from fmc_traverse(e, suf_len+pre_len); the first pre_len levels below the suffix are given by start
 	rldintv_v stack = {0,0,0};
-	uint64_t x = 0, *p;
+	uint64_t x = start->info >> suf_len*2, *p;
 
 	kv_push(rldintv_t, stack, *start);
-	stack.a[0].info = 0;
+	stack.a[0].info = pre_len > 0? pre_len<<2 | (x>>(pre_len-1)*2&3) : 0;
 	a->n = 0;
 	while (stack.n) {
 		rldintv_t top = kv_pop(stack);
@@ -288,32 +414,74 @@ typedef struct {
 	uint8_t *qtab[2];
 	rldintv_t *suf;
 	fmc64_v *kmer;
-	int depth;
+	int depth, pre_len;
+	int suf0, n_suf; // partitions in the current block
 } for_collect_t;
 
-static void collect_func(void *shared, long i, int tid)
-{
+static void collect_func(void *shared, long j, int tid)
+{ // job j is the (j/n_suf)-th subtree of partition suf0+j%n_suf
 	for_collect_t *s = (for_collect_t*)shared;
-	fmc_collect1(s->e, s->qtab, s->opt->c.suf_len, s->depth, s->opt->c.min_occ, s->opt->c.max_ec_depth, s->opt->c.q1_depth, &s->suf[i], &s->kmer[i]);
+	long i = (j / s->n_suf) << s->opt->c.suf_len*2 | (s->suf0 + j % s->n_suf);
+	if (s->pre_len > 0 && s->suf[i].x[2] < s->opt->c.min_occ) return; // the seed has been pruned
+	fmc_collect1(s->e, s->qtab, s->opt->c.suf_len, s->pre_len, s->depth, s->opt->c.min_occ, s->opt->c.max_ec_depth, s->opt->c.q1_depth, &s->suf[i], &s->kmer[j]);
+	if (fmc_verbose >= 4)
+		fprintf(stderr, "[M::%s] collected %ld k-mers from subtree %ld in thread %d\n", __func__, (long)s->kmer[j].n, i, tid);
+}
+
+static void fmc_collect_merge(int pre_len, long stride, fmc64_v *t, fmc64_v *a)
+{ // concatenate subtrees t[r*stride] in the order fmc_collect1() would traverse them from the partition root
+	int j, r, n_pre = 1<<pre_len*2;
+	size_t n = 0;
+	for (r = 0; r < n_pre; ++r)
+		n += t[r * stride].n;
+	a->n = a->m = n;
+	a->a = malloc(n * 8 + 8);
+	for (r = n_pre - 1, n = 0; r >= 0; --r) { // children are visited from T to A; the base next to the suffix comes first
+		fmc64_v *q;
+		int rev = 0;
+		for (j = 0; j < pre_len; ++j)
+			rev |= (r>>j*2&3) << (pre_len-1-j)*2;
+		q = &t[rev * stride];
+		memcpy(&a->a[n], q->a, q->n * 8);
+		n += q->n;
+		free(q->a);
+		q->a = 0, q->n = q->m = 0;
+	}
 }
 
-void fmc_kmer_stat(int suf_len, const fmc64_v *a)
+void fmc_kmer_stat(const fmc_kmer_t *km)
 {
-	int i, n_suf = 1<<suf_len*2;
+	int i;
 	int64_t tot = 0;
-	for (i = 0; i < n_suf; ++i)
-		tot += a[i].n<<1;
+	for (i = 0; i < km->n; ++i)
+		tot += km->a[i].n<<1;
 	fprintf(stderr, "[M::%s] %ld k-mers\n", __func__, (long)tot);
 }
 
-fmc64_v *fmc_collect(fmc_opt_t *opt, const char *fn_fmi)
+void fmc_kmer_destroy(fmc_kmer_t *km)
 {
+	int i;
+	if (km == 0) return;
+	for (i = 0; i < km->n; ++i) free(km->a[i].a);
+	if (km->fd >= 0) close(km->fd);
+	free(km->a); free(km->off); free(km);
+}
+
+static void fmc_kmer_write_hdr(FILE *fp, const fmc_opt_t *opt);
+static void fmc_kmer_write1(FILE *fp, const fmc64_v *a);
+static void fmc_kmer_write_idx(FILE *fp, const fmc_kmer_t *km);
+
+fmc_kmer_t *fmc_collect(fmc_opt_t *opt, const char *fn_fmi, FILE *fp)
+{ // if fp is not NULL, write each partition to fp once it is collected; the returned lists are then all empty
 	rld_t *e;
 	double tc, tr;
-	int depth = opt->c.k - opt->c.suf_len, n_suf = 1 << opt->c.suf_len*2;
+	int i, depth = opt->c.k - opt->c.suf_len, task_depth, n_pre, blk;
 	for_collect_t f;
+	fmc_kmer_t *km;
 
 	assert(0 < depth && depth <= 18);
+	task_depth = opt->task_depth < opt->c.k>>1? opt->task_depth : opt->c.k>>1; // seeds must not pass the middle base
+	task_depth = task_depth > opt->c.suf_len? task_depth : opt->c.suf_len;
 
 	fprintf(stderr, "[M::%s] reading the FMD-index... ", __func__);
 	tc = cputime(); tr = realtime();
@@ -322,129 +490,521 @@ fmc64_v *fmc_collect(fmc_opt_t *opt, const char *fn_fmi)
 
 	fprintf(stderr, "[M::%s] collecting high occurrence k-mers... ", __func__);
 	tc = cputime(); tr = realtime();
-	f.e = e; f.opt = opt; f.depth = depth;
-	f.suf = fmc_traverse(e, opt->c.suf_len);
+	km = calloc(1, sizeof(fmc_kmer_t));
+	km->n = 1 << opt->c.suf_len*2, km->fd = -1;
+	km->a = calloc(km->n, sizeof(fmc64_v));
+	f.e = e; f.opt = opt; f.depth = depth; f.pre_len = task_depth - opt->c.suf_len;
+	f.suf = fmc_traverse(e, task_depth);
 	f.qtab[0] = fmc_precal_qtab(1<<8, opt->c.err, 0.5,      opt->c.a1, opt->c.a2, opt->c.prior);
 	f.qtab[1] = fmc_precal_qtab(1<<8, opt->c.err, 0.333333, opt->c.a1, opt->c.a2, opt->c.prior);
-	f.kmer = calloc(n_suf, sizeof(fmc64_v));
-	kt_for(opt->n_threads, collect_func, &f, n_suf);
+	n_pre = 1 << f.pre_len*2;
+	blk = fp? (opt->n_threads * 64 + n_pre - 1) / n_pre : km->n; // when streaming, keep just enough subtrees for all threads
+	blk = blk < km->n? blk : km->n;
+	f.kmer = calloc((long)blk * n_pre, sizeof(fmc64_v));
+	if (fp) fmc_kmer_write_hdr(fp, opt);
+	for (f.suf0 = 0; f.suf0 < km->n; f.suf0 += f.n_suf) {
+		f.n_suf = km->n - f.suf0 < blk? km->n - f.suf0 : blk;
+		kt_for(opt->n_threads, collect_func, &f, (long)f.n_suf * n_pre);
+		for (i = 0; i < f.n_suf; ++i) {
+			fmc64_v *a = &km->a[f.suf0 + i];
+			fmc_collect_merge(f.pre_len, f.n_suf, f.kmer + i, a);
+			if (fp) {
+				fmc_kmer_write1(fp, a);
+				free(a->a);
+				a->a = 0, a->m = 0;
+			}
+		}
+	}
+	if (fp) fmc_kmer_write_idx(fp, km);
 	rld_destroy(e);
-	free(f.qtab[0]); free(f.qtab[1]); free(f.suf);
+	free(f.qtab[0]); free(f.qtab[1]); free(f.suf); free(f.kmer);
 	fprintf(stderr, "in %.3f sec (%.3f CPU sec)\n", realtime() - tr, cputime() - tc);
 
-	fmc_kmer_stat(opt->c.suf_len, f.kmer);
-	return f.kmer;
+	fmc_kmer_stat(km);
+	return km;
+}
+
+/************************
+ *** Table-free mode ***
+ ************************/
+
+static uint32_t fmc_direct_get(const fmc_direct_t *dr, uint64_t x)
+{ // x is the canonical k-mer with the last base in the lowest bits; return the cell value fmc_collect1() would compute
+	int i;
+	rldintv_t ik, ok[6];
+	uint32_t val[2];
+	ik = dr->pre[x & ((1ULL<<dr->pre_len*2) - 1)];
+	for (i = dr->pre_len; i < dr->c.k && ik.x[2] >= dr->min_occ; ++i) { // counts never increase, so stop as soon as the k-mer can't be solid
+		rld_extend(dr->e, &ik, ok, 1);
+		ik = ok[(x>>i*2&3) + 1];
+	}
+	if (ik.x[2] < dr->min_occ) return FMC_CACHE_MISSING;
+	rld_extend(dr->e, &ik, ok, 1); // backward tip
+	val[0] = fmc_intv2tip((uint8_t**)dr->qtab, ok, dr->c.max_ec_depth, dr->c.q1_depth, dr->c.min_occ);
+	rld_extend(dr->e, &ik, ok, 0); // forward tip
+	val[1] = fmc_intv2tip((uint8_t**)dr->qtab, ok, dr->c.max_ec_depth, dr->c.q1_depth, dr->c.min_occ);
+	return val[1]<<14 | val[0];
+}
+
+fmc_tab_t *fmc_tab_direct(const fmc_opt_t *opt, const char *fn_fmi)
+{
+	fmc_tab_t *t;
+	fmc_direct_t *dr;
+	rld_t *e;
+	double tc = cputime(), tr = realtime();
+
+	if ((e = rld_restore_mmap(fn_fmi)) == 0) return 0;
+	if (e->mcnt[2] != e->mcnt[5] || e->mcnt[3] != e->mcnt[4]) {
+		fprintf(stderr, "[E::%s] the table-free mode requires a bidirectional FMD-index\n", __func__);
+		rld_destroy(e);
+		return 0;
+	}
+	dr = calloc(1, sizeof(fmc_direct_t));
+	dr->e = e, dr->c = opt->c;
+	dr->min_occ = opt->c.min_occ > 1? opt->c.min_occ : 1;
+	dr->pre_len = opt->c.k < FMC_DIRECT_PRE? opt->c.k : FMC_DIRECT_PRE;
+	dr->pre = fmc_traverse(e, dr->pre_len);
+	dr->qtab[0] = fmc_precal_qtab(1<<8, opt->c.err, 0.5,      opt->c.a1, opt->c.a2, opt->c.prior);
+	dr->qtab[1] = fmc_precal_qtab(1<<8, opt->c.err, 0.333333, opt->c.a1, opt->c.a2, opt->c.prior);
+	t = calloc(1, sizeof(fmc_tab_t));
+	t->dr = dr;
+	fprintf(stderr, "[M::%s] mapped the FMD-index in %.3f sec (%.3f CPU sec)\n", __func__, realtime() - tr, cputime() - tc);
+	return t;
 }
 
 /****************************
  *** Write/read kmer list ***
  ****************************/
 
-void fmc_kmer_write(FILE *fp, const fmc_opt_t *opt, const fmc64_v *a)
+/* Layout: FMC_KLIST_MAGIC, fmc_collect_opt_t, and then for each partition the
+ * number of cells n as uint64_t followed by the n cells. At the end, the cell
+ * counts of all partitions are repeated as an index, from which partition
+ * offsets are computed without reading the lists. Lists with FMC_KMER_MAGIC
+ * have no index and are always read in full. */
+
+#define FMC_KLIST_MAGIC "FCI\2" // indexed list; keep the version in sync with FMC_KMER_MAGIC
+
+static void fmc_kmer_write_hdr(FILE *fp, const fmc_opt_t *opt)
 {
-	int i, n = 1<<opt->c.suf_len*2;
-	fwrite(FMC_KMER_MAGIC, 1, 4, fp);
+	fwrite(FMC_KLIST_MAGIC, 1, 4, fp);
 	fwrite(&opt->c, sizeof(fmc_collect_opt_t), 1, fp);
-	for (i = 0; i < n; ++i) {
-		fwrite(&a[i].n, sizeof(size_t), 1, fp);
-		fwrite(a[i].a, 8, a[i].n, fp);
+}
+
+static void fmc_kmer_write1(FILE *fp, const fmc64_v *a)
+{
+	uint64_t n = a->n;
+	fwrite(&n, 8, 1, fp);
+	fwrite(a->a, 8, a->n, fp);
+}
+
+static void fmc_kmer_write_idx(FILE *fp, const fmc_kmer_t *km)
+{
+	int i;
+	for (i = 0; i < km->n; ++i) {
+		uint64_t n = km->a[i].n;
+		fwrite(&n, 8, 1, fp);
+	}
+}
+
+int fmc_kmer_load(fmc_kmer_t *km, int i) // load partition i if it is not in memory; thread-safe for distinct i
+{
+	fmc64_v *a = &km->a[i];
+	size_t l = a->n * 8;
+	if (km->fd < 0 || a->a) return 0;
+	a->a = malloc(l + 8);
+	a->m = a->n;
+	if (pread(km->fd, a->a, l, km->off[i] + 8) != l) {
+		fprintf(stderr, "[E::%s] failed to read partition %d of the k-mer list\n", __func__, i);
+		return -1;
 	}
+	return 0;
 }
 
-fmc64_v *fmc_kmer_read(FILE *fp, fmc_opt_t *opt)
+void fmc_kmer_write(FILE *fp, const fmc_opt_t *opt, fmc_kmer_t *km)
 {
-	int i, n;
+	int i;
+	fmc_kmer_write_hdr(fp, opt);
+	for (i = 0; i < km->n; ++i) {
+		fmc64_v *a = &km->a[i];
+		if (a->a == 0 && fmc_kmer_load(km, i) < 0) break;
+		fmc_kmer_write1(fp, a);
+		if (km->fd >= 0) free(a->a), a->a = 0;
+	}
+	fmc_kmer_write_idx(fp, km);
+}
+
+static int fmc_kmer_index(fmc_kmer_t *km, int fd)
+{ // read the trailing index and compute partition offsets; don't read the lists
+	struct stat st;
+	uint64_t *cnt, off;
+	int i, ret = -1;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size < 8 * km->n) return -1;
+	cnt = malloc(8 * km->n);
+	off = st.st_size - 8 * km->n;
+	if (pread(fd, cnt, 8 * km->n, off) == 8 * km->n) {
+		km->off = malloc(8 * km->n);
+		for (i = 0, off = 4 + sizeof(fmc_collect_opt_t); i < km->n; ++i) {
+			km->a[i].n = cnt[i];
+			km->off[i] = off;
+			off += 8 + cnt[i] * 8;
+		}
+		if (off + 8 * km->n == st.st_size) ret = 0;
+	}
+	free(cnt);
+	return ret;
+}
+
+fmc_kmer_t *fmc_kmer_read(const char *fn, fmc_opt_t *opt)
+{ // partitions are loaded lazily from an indexed list in a regular file
+	FILE *fp;
+	struct stat st;
+	int i, has_idx;
 	char magic[4];
-	fmc64_v *a;
-	fread(magic, 1, 4, fp);
-	if (strncmp(magic, FMC_KMER_MAGIC, 4) != 0) {
+	fmc_kmer_t *km;
+
+	if ((fp = strcmp(fn, "-")? fopen(fn, "rb") : stdin) == 0) return 0;
+	if (fread(magic, 1, 4, fp) != 4 || (strncmp(magic, FMC_KLIST_MAGIC, 4) != 0 && strncmp(magic, FMC_KMER_MAGIC, 4) != 0)) {
 		fprintf(stderr, "[E::%s] invalid file magic\n", __func__);
+		if (fp != stdin) fclose(fp);
 		return 0;
 	}
+	has_idx = (strncmp(magic, FMC_KLIST_MAGIC, 4) == 0);
 	fread(&opt->c, sizeof(fmc_collect_opt_t), 1, fp);
-	n = 1<<opt->c.suf_len*2;
-	a = malloc(sizeof(fmc64_v) * n);
-	for (i = 0; i < n; ++i) {
-		fread(&a[i].n, sizeof(size_t), 1, fp);
-		a[i].m = a[i].n;
-		a[i].a = malloc(8 * a[i].n);
-		fread(a[i].a, 8, a[i].n, fp);
+	km = calloc(1, sizeof(fmc_kmer_t));
+	km->n = 1<<opt->c.suf_len*2, km->fd = -1;
+	km->a = calloc(km->n, sizeof(fmc64_v));
+	if (has_idx && fp != stdin && fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode)) {
+		km->fd = dup(fileno(fp));
+		if (fmc_kmer_index(km, km->fd) < 0) {
+			fprintf(stderr, "[E::%s] corrupted k-mer list index\n", __func__);
+			goto read_err;
+		}
+		if (fmc_verbose >= 3)
+			fprintf(stderr, "[M::%s] partitions will be loaded on demand\n", __func__);
+	} else { // a pipe or a list without the index; the trailing index, if any, is not read
+		for (i = 0; i < km->n; ++i) {
+			fmc64_v *a = &km->a[i];
+			uint64_t n;
+			if (fread(&n, 8, 1, fp) != 1) goto trunc_err;
+			a->n = a->m = n;
+			a->a = malloc(8 * n + 8);
+			if (fread(a->a, 8, n, fp) != n) goto trunc_err;
+		}
 	}
-	return a;
+	if (fp != stdin) fclose(fp);
+	return km;
+
+trunc_err:
+	fprintf(stderr, "[E::%s] truncated k-mer list\n", __func__);
+read_err:
+	fmc_kmer_destroy(km);
+	if (fp != stdin) fclose(fp);
+	return 0;
+}
+
+static void fmc_hash_bulk_put(fmc_hash_t *h, size_t n, const uint64_t *a)
+{ // keys in a[] are distinct, so we only need to find an empty bucket; no key comparisons
+	size_t j;
+	khint_t mask = h->n_buckets - 1;
+	assert(h->n_occupied + n <= (h->n_buckets>>2) + (h->n_buckets>>1)); // kh_put_fmc() would not resize
+	for (j = 0; j < n; ++j) {
+		khint_t i = fmc_hash_func(a[j]) & mask, step = 0;
+		while (!__ac_isempty(h->flags, i)) // the same probing sequence as kh_put_fmc()
+			i = (i + (++step)) & mask;
+		h->keys[i] = a[j];
+		__ac_set_isboth_false(h->flags, i);
+	}
+	h->size += n, h->n_occupied += n;
 }
 
-fmc_hash_t **fmc_kmer2hash(const fmc_opt_t *opt, fmc64_v *a)
+#include "ksort.h"
+#define fmc_cell_lt(a, b) ((a) < (b))
+KSORT_INIT(fmc64, uint64_t, fmc_cell_lt)
+
+static void fmc_sdict_build(fmc_sdict_t *d, int key_bits, size_t n, uint64_t *a) // a[] is sorted in place
 {
-	int i, n = 1 << opt->c.suf_len*2;
-	fmc_hash_t **h;
-	double t;
-	t = cputime();
-	fprintf(stderr, "[M::%s] constructing the hash table... ", __func__);
-	h = calloc(n, sizeof(void*));
-	for (i = 0; i < n; ++i) {
+	size_t i, j;
+	uint64_t lo_mask;
+	ks_introsort(fmc64, n, a); // keys are the high bits, so this sorts by key
+	for (d->b_bits = 0; d->b_bits < key_bits; ++d->b_bits) { // halve buckets while they stay above FMC_SDICT_BKT bytes
+		int w = (key_bits - d->b_bits - 1 + 28 + 7) >> 3;
+		if ((n >> (d->b_bits + 1)) * w < FMC_SDICT_BKT) break;
+	}
+	d->lo_bits = key_bits - d->b_bits;
+	d->w = (d->lo_bits + 28 + 7) >> 3;
+	d->n = n;
+	d->bkt = calloc((1<<d->b_bits) + 1, sizeof(uint32_t));
+	d->ent = calloc(n * d->w + 8, 1);
+	lo_mask = (1ULL<<d->lo_bits) - 1;
+	for (i = j = 0; i < n; ++i) {
+		uint64_t key = fmc_cell_get_key(a[i]), y = (key & lo_mask) << 28 | (a[i] & 0xfffffff);
+		while (j <= key >> d->lo_bits) d->bkt[j++] = i;
+		memcpy(d->ent + i * d->w, &y, d->w); // little-endian
+	}
+	while (j <= 1<<d->b_bits) d->bkt[j++] = n;
+}
+
+typedef struct {
+	const fmc_opt_t *opt;
+	fmc_kmer_t *km;
+	fmc_tab_t *t;
+	int err;
+} for_kmer2hash_t;
+
+static void kmer2hash_func(void *shared, long i, int tid)
+{
+	for_kmer2hash_t *s = (for_kmer2hash_t*)shared;
+	fmc64_v *ai = &s->km->a[i];
+	double t = realtime();
+	if (fmc_kmer_load(s->km, i) < 0) {
+		s->err = 1;
+		return;
+	}
+	if (s->t->bf) {
+		fmc_bloom_t *f = &s->t->bf[i];
 		size_t j;
-		int absent;
-		fmc64_v *ai = &a[i];
-		h[i] = kh_init(fmc);
-		kh_resize(fmc, h[i], (int)(ai->n / .7 + 1.));
+		f->n_blk = (ai->n * FMC_BLOOM_BITS + 511) / 512 + 1;
+		if (posix_memalign((void**)&f->b, 64, (size_t)f->n_blk * 64) != 0) {
+			fprintf(stderr, "[E::%s] failed to allocate the Bloom filter of partition %ld\n", __func__, i);
+			f->b = 0, s->err = 1;
+			free(ai->a);
+			ai->a = 0;
+			return;
+		}
+		memset(f->b, 0, (size_t)f->n_blk * 64);
 		for (j = 0; j < ai->n; ++j)
-			kh_put(fmc, h[i], ai->a[j], &absent);
-		assert(kh_size(h[i]) == ai->n);
-		free(ai->a);
+			fmc_bloom_put(f, fmc_cell_get_key(ai->a[j]));
 	}
-	fprintf(stderr, "in %.3f CPU sec\n", cputime() - t);
-	free(a);
-	return h;
+	if (s->t->d) {
+		fmc_sdict_build(&s->t->d[i], (s->opt->c.k - s->opt->c.suf_len) << 1, ai->n, ai->a);
+	} else {
+		fmc_hash_t *h;
+		h = s->t->h[i] = kh_init(fmc);
+		kh_resize(fmc, h, (int)(ai->n / .7 + 1.));
+		memset(h->keys, 0, h->n_buckets * sizeof(uint64_t)); // so that a dumped table is reproducible
+		fmc_hash_bulk_put(h, ai->n, ai->a);
+	}
+	if (fmc_verbose >= 4)
+		fprintf(stderr, "[M::%s] partition %ld: %ld k-mers in %.3f sec by thread %d\n", __func__, i, (long)ai->n, realtime() - t, tid);
+	free(ai->a);
+	ai->a = 0;
 }
 
-/************************
- *** Sequence reading ***
- ************************/
+void fmc_tab_destroy(fmc_tab_t *t)
+{
+	int i;
+	if (t == 0) return;
+	if (t->dr) {
+		rld_destroy(t->dr->e);
+		free(t->dr->pre); free(t->dr->qtab[0]); free(t->dr->qtab[1]);
+		free(t->dr);
+	}
+	if (t->map) { // only the headers are allocated
+		if (t->h)
+			for (i = 0; i < t->n; ++i) free(t->h[i]);
+		munmap(t->map, t->l_map);
+	} else {
+		if (t->d)
+			for (i = 0; i < t->n; ++i) free(t->d[i].bkt), free(t->d[i].ent);
+		else
+			for (i = 0; i < t->n; ++i) kh_destroy(fmc, t->h[i]);
+		if (t->bf)
+			for (i = 0; i < t->n; ++i) free(t->bf[i].b);
+	}
+	free(t->h); free(t->d); free(t->bf); free(t);
+}
+
+fmc_tab_t *fmc_kmer2hash(const fmc_opt_t *opt, fmc_kmer_t *km) // km is deallocated
+{
+	fmc_tab_t *t;
+	for_kmer2hash_t f;
+	double tc, tr;
+	tc = cputime(); tr = realtime();
+	fprintf(stderr, "[M::%s] constructing the %s... ", __func__, opt->sdict? "static dictionary" : "hash table");
+	t = calloc(1, sizeof(fmc_tab_t));
+	t->n = 1 << opt->c.suf_len*2;
+	if (opt->sdict) t->d = calloc(t->n, sizeof(fmc_sdict_t));
+	else t->h = calloc(t->n, sizeof(void*));
+	if (opt->bloom) t->bf = calloc(t->n, sizeof(fmc_bloom_t));
+	f.opt = opt, f.km = km, f.t = t, f.err = 0;
+	kt_for(opt->n_threads, kmer2hash_func, &f, t->n);
+	fprintf(stderr, "in %.3f sec (%.3f CPU sec)\n", realtime() - tr, cputime() - tc);
+	fmc_kmer_destroy(km);
+	if (f.err) {
+		fmc_tab_destroy(t);
+		return 0;
+	}
+	return t;
+}
 
-#include <zlib.h>
-#include "kseq.h"
-KSEQ_DECLARE(gzFile)
+/******************************
+ *** Serialized k-mer table ***
+ ******************************/
 
-extern unsigned char seq_nt6_table[128];
+/* Layout: FMC_TAB_MAGIC or FMC_SDICT_MAGIC, FMC_KMER_MAGIC, fmc_collect_opt_t,
+ * fmc_tabhdr_t[n], and then three arrays per partition, each aligned to
+ * FMC_TAB_ALIGN bytes: the flags and the keys of a khash table, or the bucket
+ * index and the entries of a static dictionary, followed by the Bloom filter
+ * (empty without -B). The arrays are kept as they are in memory, so lookups work
+ * on the mapped pages. */
+
+#define FMC_TAB_MAGIC   "FCH\2" // IMPORTANT: change this magic whenever the layout or fmc_hash_func() is changed!!!
+#define FMC_SDICT_MAGIC "FCS\2"
+#define FMC_TAB_ALIGN   64
 
 typedef struct {
-	int n, m;
-	char **s, **q, **name;
-} fmc_batch_t;
+	uint32_t n, x[3]; // n_buckets, size and n_occupied for khash; n, b_bits and w for fmc_sdict_t; x[2] is fmc_bloom_t::n_blk
+	uint64_t off[3], len[3]; // offsets from the start of the file and lengths of the three arrays
+} fmc_tabhdr_t;
 
-fmc_batch_t *fmc_batch_read(kseq_t *ks, int64_t batch_size)
+static inline uint64_t fmc_tab_align(uint64_t x) { return (x + FMC_TAB_ALIGN - 1) / FMC_TAB_ALIGN * FMC_TAB_ALIGN; }
+
+static uint64_t fmc_tab_pad(FILE *fp, uint64_t off, uint64_t to)
 {
-	int64_t l = 0;
-	fmc_batch_t *b;
-	b = calloc(1, sizeof(fmc_batch_t));
-	while (l < batch_size && kseq_read(ks) >= 0) {
-		if (b->n >= b->m) {
-			b->m = b->n + 1;
-			kroundup32(b->m);
-			b->s = realloc(b->s, b->m * sizeof(void*));
-			b->q = realloc(b->q, b->m * sizeof(void*));
-			b->name = realloc(b->name, b->m * sizeof(void*));
+	static const uint8_t zero[FMC_TAB_ALIGN] = {0};
+	fwrite(zero, 1, to - off, fp);
+	return to;
+}
+
+void fmc_tab_write(FILE *fp, const fmc_opt_t *opt, const fmc_tab_t *t)
+{
+	int i, j;
+	uint64_t off;
+	fmc_tabhdr_t *hdr;
+	hdr = calloc(t->n, sizeof(fmc_tabhdr_t));
+	off = 8 + sizeof(fmc_collect_opt_t) + t->n * sizeof(fmc_tabhdr_t);
+	for (i = 0; i < t->n; ++i) {
+		fmc_tabhdr_t *p = &hdr[i];
+		if (t->d) {
+			const fmc_sdict_t *d = &t->d[i];
+			p->n = d->n, p->x[0] = d->b_bits, p->x[1] = d->w;
+			p->len[0] = ((1ULL<<d->b_bits) + 1) * sizeof(uint32_t);
+			p->len[1] = (uint64_t)d->n * d->w + 8;
+		} else {
+			const fmc_hash_t *h = t->h[i];
+			p->n = h->n_buckets, p->x[0] = h->size, p->x[1] = h->n_occupied;
+			p->len[0] = (uint64_t)__ac_fsize(h->n_buckets) * sizeof(khint32_t);
+			p->len[1] = (uint64_t)h->n_buckets * sizeof(uint64_t);
 		}
-		b->s[b->n] = strdup(ks->seq.s);
-		b->q[b->n] = ks->qual.l? strdup(ks->qual.s) : 0;
-		b->name[b->n++] = strdup(ks->name.s);
-		l += ks->seq.l;
+		if (t->bf) p->x[2] = t->bf[i].n_blk, p->len[2] = (uint64_t)t->bf[i].n_blk * 64;
+		for (j = 0; j < 3; ++j)
+			p->off[j] = off = fmc_tab_align(off), off += p->len[j];
 	}
-	if (l == 0) {
-		free(b);
-		return 0;
-	} else return b;
+	fwrite(t->d? FMC_SDICT_MAGIC : FMC_TAB_MAGIC, 1, 4, fp);
+	fwrite(FMC_KMER_MAGIC, 1, 4, fp);
+	fwrite(&opt->c, sizeof(fmc_collect_opt_t), 1, fp);
+	fwrite(hdr, sizeof(fmc_tabhdr_t), t->n, fp);
+	off = 8 + sizeof(fmc_collect_opt_t) + t->n * sizeof(fmc_tabhdr_t);
+	for (i = 0; i < t->n; ++i) {
+		const void *z[3];
+		if (t->d) z[0] = t->d[i].bkt, z[1] = t->d[i].ent;
+		else z[0] = t->h[i]->flags, z[1] = t->h[i]->keys;
+		z[2] = t->bf? t->bf[i].b : 0;
+		for (j = 0; j < 3; ++j) {
+			if (hdr[i].len[j] == 0) continue;
+			off = fmc_tab_pad(fp, off, hdr[i].off[j]);
+			off += fwrite(z[j], 1, hdr[i].len[j], fp);
+		}
+	}
+	free(hdr);
 }
 
-void fmc_batch_destroy(fmc_batch_t *b)
+int fmc_tab_is_tab(const char *fn) // only a regular file can be mapped; don't consume a pipe
 {
-	int i;
-	for (i = 0; i < b->n; ++i) {
-		free(b->name[i]); free(b->s[i]); free(b->q[i]);
+	FILE *fp;
+	struct stat st;
+	char magic[4];
+	int ret = 0;
+	if (strcmp(fn, "-") == 0 || stat(fn, &st) < 0 || !S_ISREG(st.st_mode) || (fp = fopen(fn, "rb")) == 0) return 0;
+	if (fread(magic, 1, 4, fp) == 4 && (strncmp(magic, FMC_TAB_MAGIC, 4) == 0 || strncmp(magic, FMC_SDICT_MAGIC, 4) == 0))
+		ret = 1;
+	fclose(fp);
+	return ret;
+}
+
+fmc_tab_t *fmc_tab_mmap(const char *fn, fmc_opt_t *opt)
+{
+	int i, j, fd, is_sdict;
+	struct stat st;
+	uint8_t *map;
+	uint64_t off;
+	fmc_tab_t *t;
+	const fmc_tabhdr_t *hdr;
+
+	if ((fd = open(fn, O_RDONLY)) < 0) return 0;
+	if (fstat(fd, &st) < 0 || st.st_size < 8 + sizeof(fmc_collect_opt_t)) {
+		close(fd);
+		return 0;
+	}
+	map = (uint8_t*)mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return 0;
+	is_sdict = (strncmp((char*)map, FMC_SDICT_MAGIC, 4) == 0);
+	if ((!is_sdict && strncmp((char*)map, FMC_TAB_MAGIC, 4) != 0) || strncmp((char*)map + 4, FMC_KMER_MAGIC, 4) != 0) {
+		fprintf(stderr, "[E::%s] invalid file magic\n", __func__);
+		munmap(map, st.st_size);
+		return 0;
+	}
+	memcpy(&opt->c, map + 8, sizeof(fmc_collect_opt_t));
+	if (opt->c.k < 2 || opt->c.suf_len != (opt->c.k > 18? opt->c.k - 18 : 1)) { // the same rule as main_correct()
+		fprintf(stderr, "[E::%s] invalid k=%d or suffix length %d\n", __func__, opt->c.k, opt->c.suf_len);
+		munmap(map, st.st_size);
+		return 0;
 	}
-	free(b->name); free(b->s); free(b->q); free(b);
+	t = calloc(1, sizeof(fmc_tab_t));
+	t->n = 1 << opt->c.suf_len*2;
+	t->map = map, t->l_map = st.st_size;
+	if (is_sdict) t->d = calloc(t->n, sizeof(fmc_sdict_t));
+	else t->h = calloc(t->n, sizeof(void*));
+	off = 8 + sizeof(fmc_collect_opt_t);
+	hdr = (const fmc_tabhdr_t*)(map + off);
+	if (off + t->n * sizeof(fmc_tabhdr_t) > st.st_size) goto tab_err;
+	if (t->n > 0 && hdr[0].len[2] > 0) t->bf = calloc(t->n, sizeof(fmc_bloom_t));
+	for (i = 0; i < t->n; ++i) {
+		const fmc_tabhdr_t *p = &hdr[i];
+		for (j = 0; j < 3; ++j) // an empty array may be aligned past the end of the file
+			if (p->len[j] > 0 && (p->off[j] > st.st_size || p->len[j] > st.st_size - p->off[j])) goto tab_err;
+		if (t->bf) {
+			if (p->len[2] != (uint64_t)p->x[2] * 64 || p->x[2] == 0) goto tab_err;
+			t->bf[i].n_blk = p->x[2], t->bf[i].b = (uint64_t*)(map + p->off[2]);
+		}
+		if (is_sdict) {
+			fmc_sdict_t *d = &t->d[i];
+			int key_bits = (opt->c.k - opt->c.suf_len) << 1;
+			if (p->x[0] > key_bits) goto tab_err;
+			d->n = p->n, d->b_bits = p->x[0], d->w = p->x[1];
+			d->lo_bits = key_bits - d->b_bits;
+			if (d->w != (d->lo_bits + 28 + 7) >> 3) goto tab_err;
+			if (p->len[0] != ((1ULL<<d->b_bits) + 1) * sizeof(uint32_t) || p->len[1] != (uint64_t)d->n * d->w + 8) goto tab_err;
+			d->bkt = (uint32_t*)(map + p->off[0]);
+			d->ent = map + p->off[1];
+		} else {
+			fmc_hash_t *h;
+			if ((p->n & (p->n - 1)) != 0 || p->x[0] > p->x[1] || p->x[1] > p->n) goto tab_err;
+			if (p->len[0] != (uint64_t)__ac_fsize(p->n) * sizeof(khint32_t) || p->len[1] != (uint64_t)p->n * sizeof(uint64_t)) goto tab_err;
+			h = t->h[i] = calloc(1, sizeof(fmc_hash_t));
+			h->n_buckets = p->n, h->size = p->x[0], h->n_occupied = p->x[1];
+			h->flags = (khint32_t*)(map + p->off[0]);
+			h->keys = (uint64_t*)(map + p->off[1]);
+		}
+	}
+	return t;
+
+tab_err:
+	fprintf(stderr, "[E::%s] truncated or corrupted k-mer table\n", __func__);
+	fmc_tab_destroy(t);
+	return 0;
 }
 
+/************************
+ *** Sequence reading ***
+ ************************/
+
+#include "kstring.h"
+#include "seqio.h"
+
+extern unsigned char seq_nt6_table[128];
+
 #define STATE_N 0
 #define STATE_M 1
 #define STATE_I 2
@@ -484,7 +1044,6 @@ void fmc_seq_cpy_no_del(ecseq_t *dst, const ecseq_t *src)
 	int i;
 	kv_resize(ecbase_t, *dst, src->n);
 	dst->n = 0;
-	memcpy(dst->a, src->a, src->n * sizeof(ecbase_t));
 	for (i = 0; i < src->n; ++i)
 		if (src->a[i].state != STATE_D)
 			dst->a[dst->n++] = src->a[i];
@@ -510,6 +1069,15 @@ void fmc_seq_revcomp(ecseq_t *seq)
 	if (seq->n&1) seq->a[i] = ecbase_comp(&seq->a[i]);
 }
 
+void fmc_seq_revcomp_cpy(ecseq_t *dst, const ecseq_t *src) // copy and reverse complement in one pass
+{
+	int i;
+	kv_resize(ecbase_t, *dst, src->n);
+	dst->n = src->n;
+	for (i = 0; i < src->n; ++i)
+		dst->a[src->n - 1 - i] = ecbase_comp(&src->a[i]);
+}
+
 /************************
  *** Error correction ***
  ************************/
@@ -537,26 +1105,30 @@ typedef struct {
 typedef kvec_t(echeap1_t)  echeap_t;
 typedef kvec_t(ecstack1_t) ecstack_t;
 
-typedef struct {
+typedef struct { // per-thread scratch space, reused for all reads
 	ecseq_t ori, tmp[2], seq, ec_for;
 	echeap_t heap;
 	ecstack_t stack;
-	kmercache_t *cache;
+	kvec_t(uint16_t) beam; // number of hypotheses expanded at each position
+	kvec_t(uint64_t) ckey; // k-mer keys in kmer_cov()
+	kvec_t(int32_t) cdiff; // coverage differences in kmer_cov()
+	kmercache_t cache;
 } fmc_aux_t;
 
 fmc_aux_t *fmc_aux_init()
 {
 	fmc_aux_t *a;
 	a = calloc(1, sizeof(fmc_aux_t));
-	a->cache = kh_init(kache);
+	a->cache.a = calloc(1<<FMC_CACHE_BITS, sizeof(fmc_cache1_t));
 	return a;
 }
 
 void fmc_aux_destroy(fmc_aux_t *a)
 {
 	free(a->seq.a); free(a->ori.a); free(a->tmp[0].a); free(a->tmp[1].a);
-	free(a->heap.a); free(a->stack.a);
-	kh_destroy(kache, a->cache);
+	free(a->heap.a); free(a->stack.a); free(a->beam.a);
+	free(a->ckey.a); free(a->cdiff.a);
+	free(a->cache.a);
 	free(a);
 }
 
@@ -566,34 +1138,46 @@ static inline void append_to_kmer(int k, uint64_t kmer[2], int a)
 	kmer[1] = kmer[1]>>2 | (uint64_t)(3 - a) << ((k-1)<<1);
 }
 
-static inline int kmer_lookup(int k, int suf_len, uint64_t kmer[2], fmc_hash_t **h, kmercache_t *cache)
+static inline uint32_t fmc_lookup_key(int suf_len, uint64_t x, const fmc_tab_t *h, kmercache_t *cache)
+{ // x is the k-mer in the stored orientation; return the 28-bit value of its cell or FMC_CACHE_MISSING
+	uint64_t key = x | 1ULL<<63;
+	fmc_cache1_t *p;
+
+	p = &cache->a[hash_64(key) & ((1U<<FMC_CACHE_BITS) - 1)];
+	if (p->key != key) { // the table is immutable, so a slot is only replaced, never invalidated
+		uint64_t y;
+		p->key = key;
+		if (h->dr) p->val = fmc_direct_get(h->dr, x);
+		else p->val = fmc_tab_get(h, x & ((1<<(suf_len<<1)) - 1), x >> (suf_len<<1) << 28, &y)? y & 0xfffffff : FMC_CACHE_MISSING;
+		++cache->n_miss;
+	} else ++cache->n_hit;
+	return p->val;
+}
+
+static inline void fmc_lookup_prefetch(int suf_len, uint64_t x, const fmc_tab_t *h, const kmercache_t *cache)
+{ // prefetch the table slots fmc_lookup_key() will probe, unless x is cached
+	uint64_t key = x | 1ULL<<63;
+	if (h->dr || cache->a[hash_64(key) & ((1U<<FMC_CACHE_BITS) - 1)].key == key) return;
+	fmc_tab_prefetch(h, x & ((1<<(suf_len<<1)) - 1), x >> (suf_len<<1));
+}
+
+static inline int kmer_lookup(int k, int suf_len, uint64_t kmer[2], const fmc_tab_t *h, kmercache_t *cache)
 {
-	int absent, i = (kmer[0]>>(k>>1<<1)&3) < 2? 0 : 1;
-	khint_t kh, kc;
-	longcell_t x, *p;
-
-	x.suf = kmer[i] & ((1<<(suf_len<<1)) - 1);
-	x.x = kmer[i] >> (suf_len<<1) << 28;
-	x.missing = 0; // This line suppresses a gcc warning. It has no effect.
-	kc = kh_put(kache, cache, x, &absent);
-	p = &kh_key(cache, kc);
-	if (absent) {
-		fmc_hash_t *g = h[x.suf];
-		kh = kh_get(fmc, g, x.x);
-		if (kh == kh_end(g)) p->missing = 1;
-		else p->missing = 0, p->x = kh_key(g, kh);
-	}
+	int i = (kmer[0]>>(k>>1<<1)&3) < 2? 0 : 1;
+	uint32_t val;
+
+	val = fmc_lookup_key(suf_len, kmer[i], h, cache);
 	if (fmc_verbose >= 6) {
 		int i, which = (kmer[0]>>(k>>1<<1)&3) < 2? 0 : 1;
-		int val = p->missing? -1 : fmc_cell_get_val(p->x, !which);
+		int val0 = val == FMC_CACHE_MISSING? -1 : fmc_cell_get_val(val, !which);
 		fprintf(stderr, "?? ");
 		for (i = k-1; i >= 0; --i) fputc("ACGT"[kmer[0]>>2*i&3], stderr); fprintf(stderr, " - ");
 		for (i = k-1; i >= 0; --i) fputc("ACGT"[kmer[1]>>2*i&3], stderr);
 		fprintf(stderr, " - [%c] %lx", "+-"[which], (long)kmer[which]);
-		if (p->missing) fprintf(stderr, " - NOHIT\n");
-		else fprintf(stderr, " - %c%d\n", "ACGTN"[fmc_cell_get_b1(val)], fmc_cell_get_q1(val));
+		if (val0 < 0) fprintf(stderr, " - NOHIT\n");
+		else fprintf(stderr, " - %c%d\n", "ACGTN"[fmc_cell_get_b1(val0)], fmc_cell_get_q1(val0));
 	}
-	return p->missing? -1 : fmc_cell_get_val(p->x, !i);
+	return val == FMC_CACHE_MISSING? -1 : fmc_cell_get_val(val, !i);
 }
 
 static inline void update_aux(int k, fmc_aux_t *a, const echeap1_t *p, int b, int state, int penalty, int is_diff, int is_solid)
@@ -671,50 +1255,34 @@ static void path_adjustq(int diff, ecseq_t *s1, const ecseq_t *s2)
 	}
 }
 
-static int kmer_cov(const fmc_opt_t *opt, ecseq_t *seq, fmc_hash_t **h, kmercache_t *cache)
-{
-	int i, j, l, v, n_si, in_si;
-	uint64_t kmer[2], kfirst[2];
-	// compute the k-mer coverage for k-mers contained in the read
-	kmer[0] = kmer[1] = kfirst[0] = kfirst[1] = 0;
-	for (i = 0; i < seq->n; ++i) seq->a[i].cov = 0;
+static int kmer_cov(const fmc_opt_t *opt, ecseq_t *seq, const fmc_tab_t *h, fmc_aux_t *a)
+{ // all keys are computed and prefetched before any lookup, so that table probes of a read overlap
+	int i, l, k = opt->c.k, cov, n_si, in_si;
+	uint64_t kmer[2], *key;
+	int32_t *d;
+	kv_resize(uint64_t, a->ckey, seq->n);
+	kv_resize(int32_t, a->cdiff, seq->n + 1);
+	key = a->ckey.a, d = a->cdiff.a;
+	// compute the key of each k-mer in the read; UINT64_MAX if no k-mer ends at i
+	kmer[0] = kmer[1] = 0;
 	for (i = l = 0; i < seq->n; ++i) {
 		ecbase_t *p = &seq->a[i];
 		if (p->b > 3) l = 0, kmer[0] = kmer[1] = 0;
-		else ++l, append_to_kmer(opt->c.k, kmer, p->b);
-		if (l >= opt->c.k && (v = kmer_lookup(opt->c.k, opt->c.suf_len, kmer, h, cache)) >= 0)
-			for (j = 0; j < opt->c.k; ++j)
-				++seq->a[i - j].cov;
-		if (i == opt->c.k - 1)
-			kfirst[0] = kmer[0], kfirst[1] = kmer[1];
+		else ++l, append_to_kmer(k, kmer, p->b);
+		key[i] = l >= k? kmer[(kmer[0]>>(k>>1<<1)&3) < 2? 0 : 1] : UINT64_MAX;
 	}
-	/* // The following gives better k-mer coverage towards the ends of reads, but it is a bit slow and not that useful
-	// extend to the 3'-end
-	if (l >= opt->c.k && v >= 0) {
-		for (i = 0; i < opt->c.k - 1; ++i) {
-			if (v < 0 || !fmc_cell_has_b1(v) || fmc_cell_has_b2(v)) break;
-			append_to_kmer(opt->c.k, kmer, fmc_cell_get_b1(v));
-			v = kmer_lookup(opt->c.k, opt->c.suf_len, kmer, h, cache);
-			for (j = 0; j < opt->c.k - i - 1; ++j)
-				++seq->a[seq->n - 1 - j].cov;
-		}
-	}
-	// extend to the 5'-end
-	if (seq->a[0].cov > 0) {
-		kmer[0] = kfirst[1], kmer[1] = kfirst[0]; // we are extending on the reverse strand
-		v = kmer_lookup(opt->c.k, opt->c.suf_len, kmer, h, cache);
-		for (i = 0; i < opt->c.k - 1; ++i) {
-			if (v < 0 || !fmc_cell_has_b1(v) || fmc_cell_has_b2(v)) break;
-			append_to_kmer(opt->c.k, kmer, fmc_cell_get_b1(v));
-			v = kmer_lookup(opt->c.k, opt->c.suf_len, kmer, h, cache);
-			for (j = 0; j < opt->c.k - i - 1; ++j)
-				++seq->a[j].cov;
-		}
-	}
-	*/
-	// compute n_si
-	for (i = 0, n_si = 0, in_si = 0; i < seq->n; ++i) {
-		if (seq->a[i].cov >= opt->c.k - FMC_SI_GAP) {
+	for (i = k - 1; i < seq->n; ++i)
+		if (key[i] != UINT64_MAX) fmc_lookup_prefetch(opt->c.suf_len, key[i], h, &a->cache);
+	// resolve; a solid k-mer adds one to the coverage of [i-k+1,i], recorded as differences
+	memset(d, 0, (seq->n + 1) * sizeof(int32_t));
+	for (i = k - 1; i < seq->n; ++i)
+		if (key[i] != UINT64_MAX && fmc_lookup_key(opt->c.suf_len, key[i], h, &a->cache) != FMC_CACHE_MISSING)
+			++d[i - k + 1], --d[i + 1];
+	// compute the coverage and n_si in one pass
+	for (i = cov = n_si = in_si = 0; i < seq->n; ++i) {
+		cov += d[i];
+		seq->a[i].cov = cov;
+		if (cov >= k - FMC_SI_GAP) {
 			if (!in_si) ++n_si, in_si = 1;
 		} else if (in_si) in_si = 0;
 	}
@@ -731,37 +1299,46 @@ static int kmer_cov(const fmc_opt_t *opt, ecseq_t *seq, fmc_hash_t **h, kmercach
 
 typedef struct {
 	int penalty, n_paths, n_failures;
+	int heap_peak, n_expand;
 } correct1_stat_t;
 
-static correct1_stat_t fmc_correct1_aux(const fmc_opt_t *opt, fmc_hash_t **h, fmc_aux_t *a)
-{
+static correct1_stat_t fmc_correct1_aux(const fmc_opt_t *opt, const fmc_tab_t *h, fmc_aux_t *a, const ecseq_t *in, ecseq_t *out)
+{ // correct in and write the best path to out, which may be the same as in
 	echeap1_t z;
 	int l, path_end[FMC_MAX_PATHS], n_paths = 0, max_i = 0, n_failures = 0;
 	correct1_stat_t s;
 
 	assert(a->ori.n < 0x10000);
 	a->heap.n = a->stack.n = 0;
-	s.penalty = s.n_paths = s.n_failures = 0;
+	memset(&s, 0, sizeof(correct1_stat_t));
+	if (opt->beam > 0) {
+		kv_resize(uint16_t, a->beam, in->n);
+		memset(a->beam.a, 0, in->n * sizeof(uint16_t));
+	}
 	// find the first k-mer
 	memset(&z, 0, sizeof(echeap1_t));
-	for (z.i = 0, l = 0; z.i < a->seq.n;) {
-		if (a->seq.a[z.i].b > 3) l = 0, z.kmer[0] = z.kmer[1] = 0;
-		else ++l, append_to_kmer(opt->c.k, z.kmer, a->seq.a[z.i].b);
-		if (++z.i == a->seq.n) break;
-		if (l >= opt->c.k && kmer_lookup(opt->c.k, opt->c.suf_len, z.kmer, h, a->cache) >= 0) break;
+	for (z.i = 0, l = 0; z.i < in->n;) {
+		if (in->a[z.i].b > 3) l = 0, z.kmer[0] = z.kmer[1] = 0;
+		else ++l, append_to_kmer(opt->c.k, z.kmer, in->a[z.i].b);
+		if (++z.i == in->n) break;
+		if (l >= opt->c.k && kmer_lookup(opt->c.k, opt->c.suf_len, z.kmer, h, &a->cache) >= 0) break;
+	}
+	if (z.i == in->n) {
+		if (out != in) fmc_seq_cpy_no_del(out, in);
+		return s;
 	}
-	if (z.i == a->seq.n) return s;
 	z.last_solid = 0; z.ec_pos4 = 0; z.k = -1; // the first k-mer is not on the stack
 	kv_push(echeap1_t, a->heap, z);
 	// search for the best path
 	while (a->heap.n) {
-		ecbase_t *c;
+		const ecbase_t *c;
 		int val, is_excessive;
+		s.heap_peak = s.heap_peak > a->heap.n? s.heap_peak : a->heap.n;
 		z = a->heap.a[0];
 		a->heap.a[0] = kv_pop(a->heap);
 		ks_heapdown_ec(0, a->heap.n, a->heap.a);
 		if (n_paths && z.penalty > a->stack.a[path_end[0]].penalty + opt->max_penalty_diff) break;
-		if (z.i == a->seq.n) { // end of sequence
+		if (z.i == in->n) { // end of sequence
 			if (fmc_verbose >= 6) fprintf(stderr, "** penalty=%d\n", z.penalty);
 			path_end[n_paths++] = z.k;
 			if (n_paths == FMC_MAX_PATHS) break;
@@ -769,7 +1346,7 @@ static correct1_stat_t fmc_correct1_aux(const fmc_opt_t *opt, fmc_hash_t **h, fm
 		}
 		if (fmc_verbose >= 6) {
 			int i;
-			fprintf(stderr, "<- [%d] (%d,%c%d), size=%ld, penalty=%d, state=%d, ec_pos4=[", z.k, z.i, "ACGTN"[a->seq.a[z.i].b], a->seq.a[z.i].q,
+			fprintf(stderr, "<- [%d] (%d,%c%d), size=%ld, penalty=%d, state=%d, ec_pos4=[", z.k, z.i, "ACGTN"[in->a[z.i].b], in->a[z.i].q,
 					a->heap.n, z.penalty, z.k>=0? a->stack.a[z.k].state : -1);
 			for (i = 3; i >= 0; --i)
 				if (z.ec_pos4>>(i*16)&0xffff) {
@@ -778,10 +1355,15 @@ static correct1_stat_t fmc_correct1_aux(const fmc_opt_t *opt, fmc_hash_t **h, fm
 				}
 			fprintf(stderr, "]\n");
 		}
-		c = &a->seq.a[z.i];
+		if (opt->beam > 0) { // best-first, so the first hypotheses reaching a position are the best ones
+			if (a->beam.a[z.i] >= opt->beam) continue;
+			++a->beam.a[z.i];
+		}
+		++s.n_expand;
+		c = &in->a[z.i];
 		max_i = max_i > z.i? max_i : z.i;
 		is_excessive = (a->heap.n >= max_i * 3);
-		val = kmer_lookup(opt->c.k, opt->c.suf_len, z.kmer, h, a->cache);
+		val = kmer_lookup(opt->c.k, opt->c.suf_len, z.kmer, h, &a->cache);
 		if (val >= 0 && fmc_cell_has_b1(val)) { // present in the hash table
 			int b1 = fmc_cell_get_b1(val);
 			int b2 = fmc_cell_has_b2(val)? fmc_cell_get_b2(val) : 4;
@@ -814,7 +1396,7 @@ static correct1_stat_t fmc_correct1_aux(const fmc_opt_t *opt, fmc_hash_t **h, fm
 		} else {
 			update_aux(opt->c.k, a, &z, c->b < 4? c->b : lrand48()&4, STATE_N, FMC_NOHIT_PEN, 0, 0); // not present in the hash table
 			if (n_paths == 0) ++s.n_failures;
-			if (++n_failures > a->seq.n && a->heap.n > 1) a->heap.n = 1, n_failures = 0;
+			if (++n_failures > in->n && a->heap.n > 1) a->heap.n = 1, n_failures = 0;
 		}
 		if (fmc_verbose >= 6) fprintf(stderr, "//\n");
 	}
@@ -826,7 +1408,7 @@ static correct1_stat_t fmc_correct1_aux(const fmc_opt_t *opt, fmc_hash_t **h, fm
 			for (j = 0; j < n_paths; ++j) {
 				int i;
 				fprintf(stderr, "%.2d ", j);
-				path_backtrack(&a->stack, path_end[j], &a->seq, &a->tmp[0]);
+				path_backtrack(&a->stack, path_end[j], in, &a->tmp[0]);
 				for (i = 0; i < a->tmp[0].n; ++i) {
 					int s = a->tmp[0].a[i].state;
 					fputc(s == STATE_D? '-' : s == STATE_I? "acgtn"[a->tmp[0].a[i].b] : "ACGTN"[a->tmp[0].a[i].b], stderr);
@@ -836,13 +1418,13 @@ static correct1_stat_t fmc_correct1_aux(const fmc_opt_t *opt, fmc_hash_t **h, fm
 			fprintf(stderr, "//\n");
 		}
 		s.penalty = a->stack.a[path_end[0]].penalty;
-		path_backtrack(&a->stack, path_end[0], &a->seq, &a->tmp[0]);
+		path_backtrack(&a->stack, path_end[0], in, &a->tmp[0]);
 		for (j = 1; j < n_paths; ++j) {
-			path_backtrack(&a->stack, path_end[j], &a->seq, &a->tmp[1]);
+			path_backtrack(&a->stack, path_end[j], in, &a->tmp[1]);
 			path_adjustq(a->stack.a[path_end[j]].penalty - a->stack.a[path_end[0]].penalty, &a->tmp[0], &a->tmp[1]);
 		}
-		fmc_seq_cpy_no_del(&a->seq, &a->tmp[0]);
-	}
+		fmc_seq_cpy_no_del(out, &a->tmp[0]);
+	} else if (out != in) fmc_seq_cpy_no_del(out, in);
 	return s;
 }
 
@@ -871,38 +1453,40 @@ int fmc_cns_ungap(ecseq_t *s1, const ecseq_t *s2)
 typedef struct {
 	int n_diff, q_diff, n_paths[2], n_failures[2];
 	int penalty, n_conflict, n_si, to_drop;
+	int heap_peak[2], n_expand[2];
+	int is_alloc; // the corrected read didn't fit in the input strings and was allocated by fmc_correct1()
 } fmc_ecstat_t;
 
-void fmc_correct1(const fmc_opt_t *opt, fmc_hash_t **h, char **s, char **q, fmc_aux_t *a, fmc_ecstat_t *ecs)
+void fmc_correct1(const fmc_opt_t *opt, const fmc_tab_t *h, char **s, char **q, fmc_aux_t *a, fmc_ecstat_t *ecs)
 {
 	fmc_aux_t *_a = 0;
 	int i;
 	correct1_stat_t st[2];
+	ecseq_t tmp;
 
 	memset(ecs, 0, sizeof(fmc_ecstat_t));
 	if (a == 0) a = _a = fmc_aux_init();
-	kh_clear(kache, a->cache);
 	fmc_seq_conv(*s, *q, opt->defQ, &a->ori);
-	// forward strand
-	fmc_seq_cpy_no_del(&a->seq, &a->ori);
-	st[0] = fmc_correct1_aux(opt, h, a);
-	fmc_seq_cpy_no_del(&a->ec_for, &a->seq);
+	// forward strand; the search reads ori directly
+	st[0] = fmc_correct1_aux(opt, h, a, &a->ori, &a->ec_for);
 	// reverse strand
-	fmc_seq_cpy_no_del(&a->seq, &a->ori);
-	fmc_seq_revcomp(&a->seq);
-	st[1] = fmc_correct1_aux(opt, h, a);
+	fmc_seq_revcomp_cpy(&a->seq, &a->ori);
+	st[1] = fmc_correct1_aux(opt, h, a, &a->seq, &a->seq);
 	fmc_seq_revcomp(&a->seq);
 	ecs->n_conflict = fmc_cns_ungap(&a->ec_for, &a->seq);
-	fmc_seq_cpy_no_del(&a->seq, &a->ec_for);
+	tmp = a->seq, a->seq = a->ec_for, a->ec_for = tmp; // no deletions in either; swap instead of copying
 	// generate final stats
 	ecs->n_paths[0] = st[0].n_paths; ecs->n_failures[0] = st[0].n_failures;
 	ecs->n_paths[1] = st[1].n_paths; ecs->n_failures[1] = st[1].n_failures;
+	ecs->heap_peak[0] = st[0].heap_peak; ecs->n_expand[0] = st[0].n_expand;
+	ecs->heap_peak[1] = st[1].heap_peak; ecs->n_expand[1] = st[1].n_expand;
 	ecs->penalty = st[0].penalty + st[1].penalty;
-	if (a->seq.n > a->ori.n) {
-		*s = realloc(*s, a->seq.n + 1);
-		*q = realloc(*q, a->seq.n + 1);
-	} else if (!*q) *q = calloc(a->seq.n + 1, 1);
-	ecs->n_si = kmer_cov(opt, &a->seq, h, a->cache);
+	if (a->seq.n > a->ori.n || !*q) { // sequence and quality share one block, to be freed with free(*s)
+		*s = malloc((a->seq.n + 1) * 2);
+		*q = *s + a->seq.n + 1;
+		ecs->is_alloc = 1;
+	}
+	ecs->n_si = kmer_cov(opt, &a->seq, h, a);
 	ecs->to_drop = (ecs->n_si == 0 || ecs->n_failures[0] > a->seq.n || ecs->n_failures[1] > a->seq.n);
 	// write the sequence
 	for (i = 0; i < a->seq.n; ++i) {
@@ -922,46 +1506,111 @@ void fmc_correct1(const fmc_opt_t *opt, fmc_hash_t **h, char **s, char **q, fmc_
 
 typedef struct {
 	const fmc_opt_t *opt;
-	fmc_hash_t **h;
+	const fmc_tab_t *h;
 	char **name, **s, **q;
 	fmc_ecstat_t *ecs;
 	fmc_aux_t **a;
 	int64_t start;
+	int n;
+	uint64_t *order; // minimizer<<32|index, sorted; NULL to correct in the input order
 } for_correct_t;
 
 static void correct_func(void *data, long i, int tid)
 {
 	for_correct_t *f = (for_correct_t*)data;
 	if (fmc_verbose >= 5)
-		fprintf(stderr, ">%s tid:%d heap:%ld stack:%ld kmercache:%d\n",
-				f->name[i], tid, f->a[tid]->heap.m, f->a[tid]->stack.m, kh_n_buckets(f->a[tid]->cache));
+		fprintf(stderr, ">%s tid:%d heap:%ld stack:%ld kmercache:%ld/%ld\n", f->name[i], tid, f->a[tid]->heap.m, f->a[tid]->stack.m,
+				(long)f->a[tid]->cache.n_hit, (long)(f->a[tid]->cache.n_hit + f->a[tid]->cache.n_miss));
 	fmc_correct1(f->opt, f->h, &f->s[i], &f->q[i], f->a[tid], &f->ecs[i]);
 }
 
-void fmc_correct(const fmc_opt_t *opt, fmc_hash_t **h, int n, char **s, char **q, char **name, char **last_name, int64_t *last_id)
+#define FMC_REORDER_CHUNK 64 // reads per job with -R; a thread corrects neighboring reads in a row to reuse its k-mer cache
+
+static uint64_t fmc_read_minimizer(int k, const char *s)
+{ // the smallest hash of canonical k-mers; reads from the same locus are likely to share it
+	int i, l;
+	uint64_t x[2], mask = (1ULL<<k*2) - 1, min = UINT64_MAX;
+	for (i = l = 0, x[0] = x[1] = 0; s[i]; ++i) {
+		int c = seq_nt6_table[(int)s[i]] - 1;
+		if (c < 4) {
+			x[0] = (x[0]<<2 | c) & mask;
+			x[1] = x[1]>>2 | (uint64_t)(3 - c) << (k-1)*2;
+			if (++l >= k) {
+				uint64_t h = hash_64(x[0] < x[1]? x[0] : x[1]);
+				min = min < h? min : h;
+			}
+		} else l = 0;
+	}
+	return min;
+}
+
+static void minimizer_func(void *data, long i, int tid)
 {
+	for_correct_t *f = (for_correct_t*)data;
+	int k = f->opt->c.k < 31? f->opt->c.k : 31;
+	f->order[i] = fmc_read_minimizer(k, f->s[i]) >> 32 << 32 | i;
+}
+
+static void correct_chunk_func(void *data, long j, int tid)
+{
+	for_correct_t *f = (for_correct_t*)data;
+	long i, end = (j + 1) * FMC_REORDER_CHUNK < f->n? (j + 1) * FMC_REORDER_CHUNK : f->n;
+	for (i = j * FMC_REORDER_CHUNK; i < end; ++i)
+		correct_func(f, (uint32_t)f->order[i], tid);
+}
+
+void fmc_correct_core(const fmc_opt_t *opt, const fmc_tab_t *h, int n, char **s, char **q, char **name, fmc_ecstat_t *ecs, fmc_aux_t **aux)
+{ // aux[] keeps opt->n_threads scratch spaces across calls; allocated here if NULL
 	for_correct_t f;
-	int i, j;
+	int i;
 	double tr, tc;
-	char *la = *last_name;
-	int64_t li = *last_id;
+	uint64_t n_hit = 0, n_miss = 0;
 
 	if (n <= 0) return;
 	tr = realtime(), tc = cputime();
-	f.a = calloc(opt->n_threads, sizeof(void*));
 	f.opt = opt, f.h = h, f.name = name, f.s = s, f.q = q;
-	f.ecs = calloc(n, sizeof(fmc_ecstat_t));
+	f.ecs = ecs, f.n = n, f.order = 0;
+	if (aux == 0) {
+		f.a = calloc(opt->n_threads, sizeof(void*));
+		for (i = 0; i < opt->n_threads; ++i)
+			f.a[i] = fmc_aux_init();
+	} else f.a = aux;
 	for (i = 0; i < opt->n_threads; ++i)
-		f.a[i] = fmc_aux_init();
-	if (opt->n_threads == 1) {
+		f.a[i]->cache.n_hit = f.a[i]->cache.n_miss = 0;
+	if (opt->reorder) { // group reads sharing a minimizer; output is still indexed by the input order
+		f.order = malloc(n * sizeof(uint64_t));
+		kt_for(opt->n_threads, minimizer_func, &f, n);
+		ks_introsort(fmc64, n, f.order);
+		kt_for(opt->n_threads, correct_chunk_func, &f, (n + FMC_REORDER_CHUNK - 1) / FMC_REORDER_CHUNK);
+		free(f.order);
+	} else if (opt->n_threads == 1) {
 		for (i = 0; i < n; ++i)
 			correct_func(&f, i, 0);
 	} else kt_for(opt->n_threads, correct_func, &f, n);
+	for (i = 0; i < opt->n_threads; ++i) {
+		n_hit += f.a[i]->cache.n_hit, n_miss += f.a[i]->cache.n_miss;
+		if (aux == 0) fmc_aux_destroy(f.a[i]);
+	}
+	if (fmc_verbose >= 4)
+		fprintf(stderr, "[M::%s] k-mer cache: %ld hits and %ld misses (%.2f%% hit rate)\n", __func__,
+				(long)n_hit, (long)n_miss, 100. * n_hit / (n_hit + n_miss + !(n_hit + n_miss)));
+	if (aux == 0) free(f.a);
+	fprintf(stderr, "[M::%s] corrected %d reads in %.3f sec (%.3f CPU sec)\n", __func__, n, realtime() - tr, cputime() - tc);
+}
+
+void fmc_correct_write(fm_gzw_t *fp, const fmc_opt_t *opt, int n, char **s, char **q, char **name, const fmc_ecstat_t *ecs, char **last_name, int64_t *last_id)
+{
+	int i, j;
+	char *la = *last_name;
+	int64_t li = *last_id;
+	kstring_t str = {0,0,0};
+
+	if (n <= 0) return;
 	for (i = 0; i < n; ++i) {
-		fmc_ecstat_t *s = &f.ecs[i];
+		const fmc_ecstat_t *e = &ecs[i];
 		int is_same = 0; // whether the current read in the same template as the last one
 		int64_t id;
-		char *ni = f.name[i];
+		char *ni = name[i];
 		if (la) {
 			for (j = 0; la[j] && ni[j] && la[j] == ni[j]; ++j);
 			if ((la[j] == 0 && ni[j] == 0) || (j > 0 && isdigit(la[j]) && isdigit(ni[j]) && la[j-1] == '/' && la[j+1] == 0 && ni[j+1] == 0))
@@ -969,19 +1618,115 @@ void fmc_correct(const fmc_opt_t *opt, fmc_hash_t **h, int n, char **s, char **q
 		}
 		id = is_same? li : li + 1;
 		la = ni, li = id;
-		if (opt->drop_reads && s->to_drop) continue;
-		if (opt->show_ori_name) printf("@%s", ni);
-		else printf("@%ld", (long)id);
-		printf(" ec:Z:%d_%d_%d_%d_%d:%d_%d:%d\n", s->n_si, s->n_diff, s->q_diff, s->n_conflict, s->n_paths[0], s->n_paths[1], s->n_failures[0], s->n_failures[1]);
-		puts(f.s[i]); putchar('+'); putchar('\n');
-		puts(f.q[i]);
+		if (opt->drop_reads && e->to_drop) continue;
+		kputc('@', &str);
+		if (opt->show_ori_name) kputs(ni, &str);
+		else kputl(id, &str);
+		kputsn(" ec:Z:", 6, &str);
+		kputw(e->n_si, &str); kputc('_', &str); kputw(e->n_diff, &str); kputc('_', &str);
+		kputw(e->q_diff, &str); kputc('_', &str); kputw(e->n_conflict, &str); kputc('_', &str);
+		kputw(e->n_paths[0], &str); kputc(':', &str); kputw(e->n_paths[1], &str); kputc('_', &str);
+		kputw(e->n_failures[0], &str); kputc(':', &str); kputw(e->n_failures[1], &str);
+		if (opt->show_search) {
+			kputc('_', &str); kputw(e->heap_peak[0], &str); kputc(':', &str); kputw(e->heap_peak[1], &str);
+			kputc('_', &str); kputw(e->n_expand[0], &str); kputc(':', &str); kputw(e->n_expand[1], &str);
+		}
+		kputc('\n', &str);
+		kputs(s[i], &str); kputsn("\n+\n", 3, &str);
+		kputs(q[i], &str); kputc('\n', &str);
+		if (str.l >= 1<<20) { // write in chunks to bound the buffer
+			fm_gzwrite(fp, str.s, str.l);
+			str.l = 0;
+		}
 	}
+	fm_gzwrite(fp, str.s, str.l);
+	free(str.s);
 	free(*last_name);
 	*last_name = strdup(la); *last_id = li;
+}
+
+/*********************************
+ *** Read-correct-write pipeline ***
+ *********************************/
+
+void kt_pipeline(int n_threads, void *(*func)(void*, int, void*), void *shared_data, int n_steps);
+
+typedef struct step_s {
+	fm_batch_t *b;
+	int m_ecs;
+	fmc_ecstat_t *ecs;
+	struct step_s *next;
+} step_t;
+
+typedef struct {
+	const fmc_opt_t *opt;
+	const fmc_tab_t *h;
+	kseq_t *ks;
+	fm_gzw_t *out;
+	char *last_name;
+	int64_t last_id;
+	pthread_mutex_t lock;
+	step_t *pool; // finished batches; their arenas are reused by the reading step
+	fmc_aux_t **aux; // per-thread scratch space of the correction step
+} pipeline_t;
+
+static void *correct_pipeline(void *shared, int step, void *in)
+{
+	pipeline_t *p = (pipeline_t*)shared;
+	step_t *s = (step_t*)in;
+	if (step == 0) { // read a batch
+		pthread_mutex_lock(&p->lock);
+		if ((s = p->pool) != 0) p->pool = s->next;
+		pthread_mutex_unlock(&p->lock);
+		if (s == 0) {
+			s = calloc(1, sizeof(step_t));
+			s->b = fm_batch_init();
+		}
+		if (fm_batch_read(p->ks, p->opt->batch_size, 0, s->b) > 0) return s;
+		fm_batch_destroy(s->b);
+		free(s->ecs); free(s);
+		return 0;
+	} else if (step == 1) { // correct with kt_for()
+		if (s->b->n > s->m_ecs) {
+			s->m_ecs = s->b->n;
+			s->ecs = realloc(s->ecs, s->m_ecs * sizeof(fmc_ecstat_t));
+		}
+		fmc_correct_core(p->opt, p->h, s->b->n, s->b->seq, s->b->qual, s->b->name, s->ecs, p->aux);
+		return s;
+	} else if (step == 2) { // write; batches arrive in the input order
+		int i;
+		fmc_correct_write(p->out, p->opt, s->b->n, s->b->seq, s->b->qual, s->b->name, s->ecs, &p->last_name, &p->last_id);
+		for (i = 0; i < s->b->n; ++i)
+			if (s->ecs[i].is_alloc) free(s->b->seq[i]);
+		pthread_mutex_lock(&p->lock);
+		s->next = p->pool, p->pool = s;
+		pthread_mutex_unlock(&p->lock);
+	}
+	return 0;
+}
+
+void fmc_correct_file(const fmc_opt_t *opt, const fmc_tab_t *h, kseq_t *ks, fm_gzw_t *out)
+{
+	pipeline_t pl;
+	int i;
+	memset(&pl, 0, sizeof(pipeline_t));
+	pl.opt = opt, pl.h = h, pl.ks = ks, pl.out = out;
+	pl.aux = calloc(opt->n_threads, sizeof(void*));
 	for (i = 0; i < opt->n_threads; ++i)
-		fmc_aux_destroy(f.a[i]);
-	free(f.a); free(f.ecs);
-	fprintf(stderr, "[M::%s] corrected %d reads in %.3f sec (%.3f CPU sec)\n", __func__, n, realtime() - tr, cputime() - tc);
+		pl.aux[i] = fmc_aux_init();
+	pthread_mutex_init(&pl.lock, 0);
+	kt_pipeline(3, correct_pipeline, &pl, 3); // up to three batches in flight: one per step
+	while (pl.pool) {
+		step_t *s = pl.pool;
+		pl.pool = s->next;
+		fm_batch_destroy(s->b);
+		free(s->ecs); free(s);
+	}
+	for (i = 0; i < opt->n_threads; ++i)
+		fmc_aux_destroy(pl.aux[i]);
+	free(pl.aux);
+	pthread_mutex_destroy(&pl.lock);
+	free(pl.last_name);
 }
 
 /*********************
@@ -990,28 +1735,38 @@ void fmc_correct(const fmc_opt_t *opt, fmc_hash_t **h, int n, char **s, char **q
 
 int main_correct(int argc, char *argv[])
 {
-	int c;
+	int c, dump_tab = 0, no_tab = 0;
 	fmc_opt_t opt;
-	fmc64_v *kmer;
-	char *fn_kmer = 0, *last_name = 0;
-	int64_t last_id = 0;
+	fmc_kmer_t *kmer = 0;
+	fmc_tab_t *tab = 0;
+	char *fn_kmer = 0, *fn_out = 0;
 
 	liftrlimit();
 
 	fmc_opt_init(&opt);
-	while ((c = getopt(argc, argv, "DOk:o:t:h:v:p:e:q:w:")) >= 0) {
+	while ((c = getopt(argc, argv, "BDIOPRSXk:o:t:h:v:p:e:q:w:T:b:W:Z:")) >= 0) {
 		if (c == 'k') opt.c.k = atoi(optarg);
 		else if (c == 'd') opt.c.q1_depth = atoi(optarg);
 		else if (c == 'o') opt.c.min_occ = atoi(optarg), opt.c.max_ec_depth = opt.c.min_occ - 1;
 		else if (c == 'p') opt.c.prior = atof(optarg);
 		else if (c == 'e') opt.c.err = atof(optarg);
 		else if (c == 't') opt.n_threads = atoi(optarg);
+		else if (c == 'b') opt.batch_size = atol(optarg);
 		else if (c == 'h') fn_kmer = optarg;
 		else if (c == 'v') fmc_verbose = atoi(optarg);
 		else if (c == 'q') opt.ecQ = atoi(optarg);
 		else if (c == 'O') opt.show_ori_name = 1;
 		else if (c == 'D') opt.drop_reads = 1;
 		else if (c == 'w') opt.max_dist4 = atoi(optarg);
+		else if (c == 'T') opt.task_depth = atoi(optarg);
+		else if (c == 'P') dump_tab = 1;
+		else if (c == 'S') opt.sdict = 1;
+		else if (c == 'B') opt.bloom = 1;
+		else if (c == 'I') no_tab = 1;
+		else if (c == 'R') opt.reorder = 1;
+		else if (c == 'W') opt.beam = atoi(optarg) < 0xffff? atoi(optarg) : 0xffff;
+		else if (c == 'X') opt.show_search = 1;
+		else if (c == 'Z') fn_out = optarg;
 	}
 	if (!(opt.c.k&1)) {
 		++opt.c.k;
@@ -1021,62 +1776,111 @@ int main_correct(int argc, char *argv[])
 		fprintf(stderr, "\n");
 		fprintf(stderr, "Usage:   fermi2 correct [options] index.fmd [reads.fq]\n\n");
 		fprintf(stderr, "Options: -t INT     number of threads [1]\n");
+		fprintf(stderr, "         -b INT     bases per batch; up to three batches are in memory [%ld]\n", (long)opt.batch_size);
+		fprintf(stderr, "         -T INT     split k-mer collection into 4^INT subtrees [%d]\n", opt.task_depth);
 		fprintf(stderr, "         -k INT     k-mer length [%d]\n", opt.c.k);
 		fprintf(stderr, "         -o INT     min occurrence for a solid k-mer [%d]\n", opt.c.min_occ);
 		fprintf(stderr, "         -d INT     correct singletons out of INT bases [%d]\n\n", opt.c.q1_depth);
-		fprintf(stderr, "         -h FILE    get solid k-mer list from FILE [null]\n");
+		fprintf(stderr, "         -h FILE    get solid k-mer list or prebuilt table from FILE [null]\n");
+		fprintf(stderr, "         -P         dump a prebuilt table, which -h loads with mmap\n");
+		fprintf(stderr, "         -S         use a static sorted dictionary instead of hash tables (smaller)\n");
+		fprintf(stderr, "         -B         add a Bloom filter to skip most lookups of missing k-mers\n");
+		fprintf(stderr, "         -I         no table; look up k-mers in the mmap'd index (no startup cost; k<=31)\n");
 		fprintf(stderr, "         -q INT     protect Q>INT bases unless they occur once [%d]\n", opt.ecQ);
 		fprintf(stderr, "         -w INT     no more than 4 corrections per INT-bp window [%d]\n", opt.max_dist4);
+		fprintf(stderr, "         -R         correct reads sharing a minimizer together for better k-mer cache hits\n");
+		fprintf(stderr, "         -W INT     expand at most INT hypotheses per read position; 0 for no limit [%d]\n", opt.beam);
+		fprintf(stderr, "         -X         append peak heap sizes and expansions of both strands to ec:Z\n");
 		fprintf(stderr, "         -D         drop error-prone reads\n");
 		fprintf(stderr, "         -O         print the original read name\n");
+		fprintf(stderr, "         -Z FILE    write corrected reads to FILE in the BGZF format [stdout]\n");
 		fprintf(stderr, "\n");
 		fprintf(stderr, "Notes: If reads.fq is absent, this command dumps the list of solid k-mers.\n");
-		fprintf(stderr, "       The dump can be loaded later with option -h.\n\n");
+		fprintf(stderr, "       The dump can be loaded later with option -h.\n");
+		fprintf(stderr, "       A prebuilt table (-P) is larger, but it is loaded instantly and shared\n");
+		fprintf(stderr, "       between processes.\n\n");
+		return 1;
+	}
+	if (opt.task_depth < 1 || opt.task_depth > FMC_MAX_TASK_DEPTH) {
+		fprintf(stderr, "[E::%s] -T must be between 1 and %d\n", __func__, FMC_MAX_TASK_DEPTH);
+		return 1;
+	}
+	if (dump_tab && optind + 2 <= argc) {
+		fprintf(stderr, "[E::%s] -P writes the k-mer table and can't be used with input reads\n", __func__);
 		return 1;
 	}
 	opt.c.suf_len = opt.c.k > 18? opt.c.k - 18 : 1;
 
-	if (fn_kmer) {
-		FILE *fp;
-		fp = strcmp(fn_kmer, "-")? fopen(fn_kmer, "rb") : stdin;
-		assert(fp);
-		kmer = fmc_kmer_read(fp, &opt);
-		fclose(fp);
-	} else kmer = fmc_collect(&opt, argv[optind]);
+	if (no_tab) {
+		if (opt.c.k > 31 || fn_kmer || dump_tab || optind + 2 > argc) {
+			fprintf(stderr, "[E::%s] -I requires k<=31 and input reads, and can't be used with -h or -P\n", __func__);
+			return 1;
+		}
+		if ((tab = fmc_tab_direct(&opt, argv[optind])) == 0) {
+			fprintf(stderr, "[E::%s] failed to load the FMD-index\n", __func__);
+			return 1;
+		}
+	} else if (fn_kmer && fmc_tab_is_tab(fn_kmer)) {
+		tab = fmc_tab_mmap(fn_kmer, &opt);
+		if (tab == 0) {
+			fprintf(stderr, "[E::%s] failed to load the prebuilt k-mer table\n", __func__);
+			return 1;
+		}
+		if (opt.bloom && tab->bf == 0)
+			fprintf(stderr, "[W::%s] the prebuilt k-mer table has no Bloom filter; -B is ignored\n", __func__);
+	} else if (fn_kmer) {
+		if ((kmer = fmc_kmer_read(fn_kmer, &opt)) == 0) {
+			fprintf(stderr, "[E::%s] failed to load the k-mer list\n", __func__);
+			return 1;
+		}
+	} else if (optind + 2 > argc && !dump_tab) { // write partitions as they are collected
+		fmc_kmer_destroy(fmc_collect(&opt, argv[optind], stdout));
+		return 0;
+	} else kmer = fmc_collect(&opt, argv[optind], 0);
 
 	if (optind + 2 > argc) {
-		int i;
-		fmc_kmer_write(stdout, &opt, kmer);
-		for (i = 0; i < 1<<opt.c.suf_len*2; ++i)
-			free(kmer[i].a);
-		free(kmer);
+		if (dump_tab) {
+			if (tab == 0 && (tab = fmc_kmer2hash(&opt, kmer)) == 0) return 1; // kmer is deallocated here
+			fmc_tab_write(stdout, &opt, tab);
+			fmc_tab_destroy(tab);
+		} else if (kmer) {
+			fmc_kmer_write(stdout, &opt, kmer);
+			fmc_kmer_destroy(kmer);
+		} else {
+			fprintf(stderr, "[E::%s] a prebuilt table can't be converted back to a k-mer list\n", __func__);
+			fmc_tab_destroy(tab);
+			return 1;
+		}
 		return 0;
 	} else {
-		fmc_hash_t **h;
-		int i;
 		kseq_t *ks;
-		gzFile fp;
-		fmc_batch_t *b;
-
-		h = fmc_kmer2hash(&opt, kmer); // kmer is deallocated here
-		fp = gzopen(argv[optind+1], "r");
-		ks = kseq_init(fp);
-		while ((b = fmc_batch_read(ks, opt.batch_size)) != 0) {
-			fmc_correct(&opt, h, b->n, b->s, b->q, b->name, &last_name, &last_id);
-			fmc_batch_destroy(b);
+		fm_gzf_t *fp;
+		fm_gzw_t *out;
+		int ret;
+
+		if (tab == 0 && (tab = fmc_kmer2hash(&opt, kmer)) == 0) return 1; // kmer is deallocated here
+		fp = fm_gzopen(argv[optind+1], opt.n_threads);
+		out = fm_gzwopen(fn_out, opt.n_threads);
+		if (fp == 0 || out == 0) {
+			fprintf(stderr, "[E::%s] failed to open the input or the output file\n", __func__);
+			fm_gzclose(fp); fm_gzwclose(out);
+			fmc_tab_destroy(tab);
+			return 1;
 		}
-		free(last_name);
+		ks = kseq_init(fp);
+		fmc_correct_file(&opt, tab, ks, out);
 		kseq_destroy(ks);
-		gzclose(fp);
-		for (i = 0; i < 1<<opt.c.suf_len*2; ++i)
-			kh_destroy(fmc, h[i]);
-		free(h);
+		ret = fm_gzclose(fp) < 0? -1 : 0;
+		if (fm_gzwclose(out) < 0) ret = -1;
+		fmc_tab_destroy(tab);
+		if (ret < 0) return 1;
 	}
 	return 0;
 }
 
 int main_inspectk(int argc, char *argv[])
 {
+	extern int fm_query(const rld_t *e, int len, const char *s, rldintv_t *ik, rldintv_t ok[6]);
 	rld_t *e;
 	int j;
 	if (argc < 3) {
@@ -1089,17 +1893,8 @@ int main_inspectk(int argc, char *argv[])
 		rldintv_t s, t[6];
 		char *aj = argv[j];
 		len = strlen(aj);
-		s.x[0] = s.x[1] = 0; s.x[2] = e->mcnt[0];
 		printf("%d\t", len);
-		for (i = len - 1; i >= 0; --i) {
-			int c = seq_nt6_table[(int)aj[i]];
-			rld_extend(e, &s, t, 1);
-			if (t[c].x[2] == 0) break;
-			s = t[c];
-			rld_extend(e, &s, t, 1);
-		}
-		printf("%d\t", len - 1 - i);
-		rld_extend(e, &s, t, 1);
+		printf("%d\t", fm_query(e, len, aj, &s, t));
 		for (i = 1; i <= 4; ++i) {
 			if (i != 1) putchar(':');
 			printf("%ld", (long)t[i].x[2]);
@@ -2,9 +2,18 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
 #include "kstring.h"
 #include "kvec.h"
 #include "rld0.h"
+#include "seqio.h"
+#include "ksort.h"
+#include "khash.h"
+KHASH_DECLARE(64, uint64_t, uint64_t)
 
 static int dfs_verbose = 3;
 
@@ -13,6 +22,7 @@ static int dfs_verbose = 3;
  ******************/
 
 #define DFS_SUF_LEN 5
+#define DFS_WINDOW  4 // with an end() callback, suffixes are claimed at most DFS_WINDOW*n_threads ahead of the oldest unfinished one
 
 typedef struct {
 	int64_t k, l;
@@ -25,6 +35,12 @@ typedef struct {
 
 typedef void (*fmdfs_f)(void *data, int tid, int k, char *path, const fmint6_t *size, int *cont);
 typedef void (*fmdfs2_f)(void *data, int tid, int k, char *path, const rldintv_t *ik, const rldintv_t *ok, int *cont);
+typedef void (*fmdfs_end_f)(void *data, int tid, long suf); // called once all nodes ending with suffix $suf have been visited
+
+static inline int fm_dfs_suf_len(int max_k) // paths ending with the same suf_len bases are visited in one task
+{
+	return max_k>>1 < DFS_SUF_LEN? max_k>>1 : DFS_SUF_LEN;
+}
 
 void fm_dfs_core(int n, rld_t *const*e, int is_half, int max_k, int suf_len, int suf, fmdfs_f func, void *data, int tid)
 { // this routine is similar to fmc_collect1()
@@ -150,55 +166,592 @@ void fm_dfs2_core(int n, rld_t *const*e, int is_half, int max_k, int suf_len, in
 }
 
 typedef struct {
-	int n, max_k, suf_len, is_half;
+	uint64_t x; // BWT position in the first index
+	int j;
+} dfspos_t;
+
+#define dfspos_lt(a, b) ((a).x < (b).x)
+KSORT_INIT(dfs, dfspos_t, dfspos_lt)
+
+typedef struct {
+	int d, c; // depth and the first base of the path
+	int suf;
+} dfsnode_t;
+
+typedef struct { // nodes to visit; n intervals and L bytes of path per node
+	kvec_t(dfsnode_t) st;
+	kvec_t(rldintv_t) sv;
+	kvec_t(char) sp; // the path is right-aligned and NULL terminated
+} dfsstack_t;
+
+typedef struct {
+	dfsstack_t s;
+	pthread_mutex_t lock; // the owner pops and pushes at the top; thieves take from the bottom
+	volatile long bot; // suffix of the bottom node; LONG_MAX if empty
+	long n_steals;
+} dfsdeque_t;
+
+typedef struct {
+	int n, max_k, suf_len, is_half, chunk, n_threads;
 	rld_t *const*e;
 	void *data;
 	fmdfs_f func;
 	fmdfs2_f func2;
+	fmdfs_end_f end;
+	long n_suf, win;
+	volatile int *n_pend; // number of pending nodes per suffix
+	volatile long next_suf; // the next suffix not taken by any worker
+	volatile long oldest; // the oldest suffix not finished
+	volatile int n_active; // workers holding nodes; a non-empty deque implies an active owner
+	char *done;
+	pthread_mutex_t lock; // protects done[] and oldest
+	dfsdeque_t *q;
 } shared_t;
 
-static void dfs_worker(void *data, long suf, int tid)
+static long dfs_claim(shared_t *d)
+{ // take the next suffix if it is within the window; return -1 otherwise
+	long suf;
+	while ((suf = d->next_suf) < d->n_suf && suf < d->oldest + d->win)
+		if (__sync_bool_compare_and_swap(&d->next_suf, suf, suf + 1))
+			return suf;
+	return -1;
+}
+
+static void dfs_retire(shared_t *d, int tid, long suf)
+{ // all nodes ending with suf have been visited
+	if (d->end) d->end(d->data, tid, suf);
+	pthread_mutex_lock(&d->lock);
+	d->done[suf] = 1;
+	while (d->oldest < d->n_suf && d->done[d->oldest]) ++d->oldest;
+	pthread_mutex_unlock(&d->lock);
+}
+
+static inline void dfs_deque_bot(dfsdeque_t *q) // call with q->lock held
 {
-	shared_t *d = (shared_t*)data;
-	if (d->func) fm_dfs_core(d->n, d->e, d->is_half, d->max_k, d->suf_len, suf, d->func, d->data, tid);
-	if (d->func2) fm_dfs2_core(d->n, d->e, d->is_half, d->max_k, d->suf_len, suf, d->func2, d->data, tid);
-	if (dfs_verbose >= 4)
-		fprintf(stderr, "[M::%s] processed suffix %ld in thread %d\n", __func__, suf, tid);
+	q->bot = q->s.st.n? q->s.st.a[0].suf : LONG_MAX;
 }
 
-void fm_dfs(int n, rld_t *const*e, int is_half, int max_k, int n_threads, fmdfs_f func, fmdfs2_f func2, void *data)
+static inline void dfs_stack_append(dfsstack_t *s, int n, int L, int m, const dfsnode_t *cn, const rldintv_t *cv, const char *cp)
 {
-	extern void kt_for(int n_threads, void (*func)(void*,long,int), void *data, long n);
+	kv_resize(dfsnode_t, s->st, s->st.n + m);
+	kv_resize(rldintv_t, s->sv, s->sv.n + m * n);
+	kv_resize(char, s->sp, s->sp.n + m * L);
+	memcpy(&s->st.a[s->st.n], cn, m * sizeof(dfsnode_t));
+	memcpy(&s->sv.a[s->sv.n], cv, (size_t)m * n * sizeof(rldintv_t));
+	memcpy(&s->sp.a[s->sp.n], cp, (size_t)m * L);
+	s->st.n += m, s->sv.n += m * n, s->sp.n += m * L;
+}
+
+static void dfs_push_root(shared_t *d, dfsstack_t *s, int suf)
+{
+	int i, j, L = d->max_k + 1;
+	dfsnode_t *p;
+	char *path;
+	kv_pushp(dfsnode_t, s->st, &p);
+	p->d = d->suf_len, p->c = (suf>>(d->suf_len-1)*2&3) + 1, p->suf = suf;
+	d->n_pend[suf] = 1;
+	kv_resize(rldintv_t, s->sv, s->sv.n + d->n);
+	for (i = 0; i < d->n; ++i) {
+		rldintv_t *q = &s->sv.a[s->sv.n++], t[6];
+		q->x[0] = q->x[1] = q->info = 0, q->x[2] = d->e[i]->mcnt[0];
+		for (j = 0; j < d->suf_len; ++j) {
+			rld_extend(d->e[i], q, t, 1);
+			*q = t[(suf>>j*2&3) + 1];
+		}
+	}
+	kv_resize(char, s->sp, s->sp.n + L);
+	path = &s->sp.a[s->sp.n];
+	s->sp.n += L;
+	for (j = 0; j < d->suf_len; ++j)
+		path[d->max_k - j - 1] = "ACGT"[suf>>j*2&3];
+	path[d->max_k] = 0;
+}
+
+static int dfs_steal(shared_t *d, int tid)
+{ // move the bottom half of a deque to ours; nodes at the bottom are the shallowest, with the largest subtrees
+  // prefer the deque holding the oldest suffix, so that the window of claimed suffixes can move on
+	int i, max_i = -1, m = 0, n = d->n, L = d->max_k + 1;
+	size_t max = 0;
+	long min_bot = LONG_MAX;
+	dfsdeque_t *v;
+	for (i = 0; i < d->n_threads; ++i) {
+		long bot = d->q[i].bot;
+		size_t n_st = d->q[i].s.st.n;
+		if (i == tid || n_st == 0) continue;
+		if (bot < min_bot || (bot == min_bot && n_st > max))
+			min_bot = bot, max = n_st, max_i = i;
+	}
+	if (max_i < 0) return 0;
+	v = &d->q[max_i];
+	pthread_mutex_lock(&v->lock);
+	if (v->s.st.n > 0) {
+		dfsstack_t *s = &v->s;
+		m = (s->st.n + 1) >> 1;
+		pthread_mutex_lock(&d->q[tid].lock);
+		dfs_stack_append(&d->q[tid].s, n, L, m, s->st.a, s->sv.a, s->sp.a);
+		dfs_deque_bot(&d->q[tid]);
+		pthread_mutex_unlock(&d->q[tid].lock);
+		__sync_fetch_and_add(&d->n_active, 1); // before unlocking, so no one sees both deques empty and n_active==0
+		s->st.n -= m, s->sv.n -= m * n, s->sp.n -= m * L;
+		memmove(s->st.a, s->st.a + m, s->st.n * sizeof(dfsnode_t));
+		memmove(s->sv.a, s->sv.a + m * n, s->sv.n * sizeof(rldintv_t));
+		memmove(s->sp.a, s->sp.a + m * L, s->sp.n);
+		dfs_deque_bot(v);
+		++d->q[tid].n_steals;
+	}
+	pthread_mutex_unlock(&v->lock);
+	return m;
+}
+
+typedef struct {
+	shared_t *d;
+	int tid;
+} dfsworker_t;
+
+static void *dfs_chunk_worker(void *data)
+{ // visit the same nodes as fm_dfs_core() or fm_dfs2_core(), but expand up to $chunk nodes from the stack top at a time
+	dfsworker_t *w = (dfsworker_t*)data;
+	shared_t *d = w->d;
+	dfsdeque_t *q = &d->q[w->tid];
+	int i, j, c, m, n = d->n, max_k = d->max_k, chunk = d->chunk, L = max_k + 1, tid = w->tid;
+	dfsnode_t *cn;
+	rldintv_t *cv, *o;
+	fmint6_t *size;
+	dfspos_t *ord;
+	uint64_t *pos;
+	char *cp;
+	dfsstack_t ch; // children of the current chunk
+
+	memset(&ch, 0, sizeof(dfsstack_t));
+	cn = malloc(chunk * sizeof(dfsnode_t));
+	cv = malloc((size_t)chunk * n * sizeof(rldintv_t));
+	o = malloc((size_t)chunk * n * 6 * sizeof(rldintv_t));
+	cp = malloc((size_t)chunk * L);
+	size = malloc(n * sizeof(fmint6_t));
+	ord = malloc(chunk * sizeof(dfspos_t));
+	pos = malloc(chunk * 2 * sizeof(uint64_t));
+	for (;;) {
+		dfsstack_t *s = &q->s;
+		// take nodes from the top of our deque, a new suffix, or nodes from another deque
+		pthread_mutex_lock(&q->lock);
+		m = s->st.n < chunk? s->st.n : chunk;
+		s->st.n -= m, s->sv.n -= m * n, s->sp.n -= m * L;
+		memcpy(cn, &s->st.a[s->st.n], m * sizeof(dfsnode_t));
+		memcpy(cv, &s->sv.a[s->sv.n], (size_t)m * n * sizeof(rldintv_t));
+		memcpy(cp, &s->sp.a[s->sp.n], (size_t)m * L);
+		dfs_deque_bot(q);
+		pthread_mutex_unlock(&q->lock);
+		if (m == 0) {
+			long suf;
+			if ((suf = dfs_claim(d)) < 0) {
+				__sync_fetch_and_sub(&d->n_active, 1);
+				for (;;) { // steal, or wait until the window moves on
+					if (dfs_steal(d, tid)) break; // dfs_steal() increments n_active
+					__sync_fetch_and_add(&d->n_active, 1); // before claiming, so no one sees n_active==0 with a suffix in flight
+					if ((suf = dfs_claim(d)) >= 0) break;
+					__sync_fetch_and_sub(&d->n_active, 1);
+					if (d->n_active == 0 && d->next_suf >= d->n_suf) goto end_worker;
+					sched_yield();
+				}
+			}
+			if (suf >= 0) {
+				pthread_mutex_lock(&q->lock);
+				dfs_push_root(d, s, suf);
+				dfs_deque_bot(q);
+				pthread_mutex_unlock(&q->lock);
+			}
+			continue;
+		}
+		// compute ranks in the order of BWT positions, after prefetching
+		for (j = 0; j < m; ++j)
+			ord[j].x = cv[j * n].x[0], ord[j].j = j;
+		ks_introsort(dfs, m, ord);
+		for (i = 0; i < n; ++i) {
+			for (j = 0; j < m; ++j) {
+				const rldintv_t *p = &cv[ord[j].j * n + i];
+				pos[j<<1] = p->x[0], pos[j<<1|1] = p->x[0] + p->x[2];
+			}
+			rld_prefetch(d->e[i], m<<1, pos);
+			for (j = 0; j < m; ++j) {
+				int jj = ord[j].j;
+				rld_extend(d->e[i], &cv[jj * n + i], &o[(jj * n + i) * 6], 1);
+			}
+		}
+		// call back and collect children; the node last pushed is visited first
+		ch.st.n = ch.sv.n = ch.sp.n = 0;
+		for (j = m - 1; j >= 0; --j) {
+			int dep = cn[j].d, end, cont = 0x1E, n_ch = 0;
+			rldintv_t *oj = &o[j * n * 6];
+			char *path = &cp[j * L];
+			path[max_k - dep] = "\0ACGTN"[cn[j].c];
+			for (i = 0; i < n; ++i)
+				for (c = 0; c < 6; ++c)
+					if (oj[i * 6 + c].x[2] == 0) cont &= ~(1<<c);
+			if (d->func2) d->func2(d->data, tid, dep, path + (max_k - dep), &cv[j * n], oj, &cont);
+			else {
+				for (i = 0; i < n; ++i)
+					for (c = 0; c < 6; ++c)
+						size[i].c[c] = oj[i * 6 + c].x[2];
+				d->func(d->data, tid, dep, path + (max_k - dep), size, &cont);
+			}
+			end = dep == max_k? 0 : dep == max_k>>1 && d->is_half? 2 : 4;
+			for (c = 1; c <= end; ++c) {
+				dfsnode_t *p;
+				if ((cont>>c&1) == 0) continue;
+				kv_pushp(dfsnode_t, ch.st, &p);
+				p->d = dep + 1, p->c = c, p->suf = cn[j].suf;
+				kv_resize(rldintv_t, ch.sv, ch.sv.n + n);
+				for (i = 0; i < n; ++i)
+					ch.sv.a[ch.sv.n++] = oj[i * 6 + c];
+				kv_resize(char, ch.sp, ch.sp.n + L);
+				memcpy(&ch.sp.a[ch.sp.n + max_k - dep], path + (max_k - dep), dep + 1);
+				ch.sp.n += L;
+				++n_ch;
+			}
+			if (__sync_add_and_fetch(&d->n_pend[cn[j].suf], n_ch - 1) == 0) // children are counted before the node is retired
+				dfs_retire(d, tid, cn[j].suf);
+		}
+		if (ch.st.n) {
+			pthread_mutex_lock(&q->lock);
+			dfs_stack_append(s, n, L, ch.st.n, ch.st.a, ch.sv.a, ch.sp.a);
+			dfs_deque_bot(q);
+			pthread_mutex_unlock(&q->lock);
+		}
+	}
+end_worker:
+	free(ch.st.a); free(ch.sv.a); free(ch.sp.a);
+	free(cn); free(cv); free(o); free(cp); free(size); free(ord); free(pos);
+	return 0;
+}
+
+static void *dfs_plain_worker(void *data)
+{ // one suffix at a time with fm_dfs_core() or fm_dfs2_core()
+	dfsworker_t *w = (dfsworker_t*)data;
+	shared_t *d = w->d;
+	long suf;
+	while (d->next_suf < d->n_suf) {
+		if ((suf = dfs_claim(d)) < 0) { // wait for the oldest suffix to finish
+			sched_yield();
+			continue;
+		}
+		if (d->func) fm_dfs_core(d->n, d->e, d->is_half, d->max_k, d->suf_len, suf, d->func, d->data, w->tid);
+		else if (d->func2) fm_dfs2_core(d->n, d->e, d->is_half, d->max_k, d->suf_len, suf, d->func2, d->data, w->tid);
+		dfs_retire(d, w->tid, suf);
+		if (dfs_verbose >= 4)
+			fprintf(stderr, "[M::%s] processed suffix %ld in thread %d\n", __func__, suf, w->tid);
+	}
+	return 0;
+}
+
+void fm_dfs(int n, rld_t *const*e, int is_half, int max_k, int n_threads, int chunk, fmdfs_f func, fmdfs2_f func2, fmdfs_end_f end, void *data)
+{ // with chunk>0, nodes are expanded $chunk at a time with prefetched rank queries, and idle threads steal
+  // pending subtrees from busy ones; the callbacks see the same nodes in a different order
+	int i;
+	pthread_t *tid;
+	dfsworker_t *w;
 	shared_t d;
-	int n_suf;
-	d.n = n, d.e = e, d.data = data, d.func = func, d.func2 = func2, d.max_k = max_k; d.is_half = is_half;
-	d.suf_len = max_k>>1 < DFS_SUF_LEN? max_k>>1 : DFS_SUF_LEN;
-	n_suf = 1<<d.suf_len*2;
-	n_threads = n_threads < n_suf? n_threads : n_suf;
-	kt_for(n_threads, dfs_worker, &d, n_suf);
+
+	memset(&d, 0, sizeof(shared_t));
+	d.n = n, d.e = e, d.data = data, d.func = func, d.func2 = func2, d.max_k = max_k; d.is_half = is_half, d.chunk = chunk, d.end = end;
+	d.suf_len = fm_dfs_suf_len(max_k);
+	d.n_suf = 1<<d.suf_len*2;
+	d.n_threads = n_threads = n_threads < d.n_suf? n_threads : d.n_suf;
+	d.win = end? (long)n_threads * DFS_WINDOW : d.n_suf; // without end(), nothing is held per suffix
+	if (func2 && chunk > 0)
+		for (i = 0; i < n; ++i) // check bidirectionality
+			assert(e[i]->mcnt[2] == e[i]->mcnt[5] && e[i]->mcnt[3] == e[i]->mcnt[4]);
+	d.n_active = n_threads;
+	d.done = calloc(d.n_suf, 1);
+	d.n_pend = calloc(d.n_suf, sizeof(int));
+	d.q = calloc(n_threads, sizeof(dfsdeque_t));
+	pthread_mutex_init(&d.lock, 0);
+	tid = alloca(n_threads * sizeof(pthread_t));
+	w = alloca(n_threads * sizeof(dfsworker_t));
+	for (i = 0; i < n_threads; ++i) {
+		pthread_mutex_init(&d.q[i].lock, 0);
+		d.q[i].bot = LONG_MAX;
+		w[i].d = &d, w[i].tid = i;
+	}
+	for (i = 0; i < n_threads; ++i) pthread_create(&tid[i], 0, chunk > 0? dfs_chunk_worker : dfs_plain_worker, &w[i]);
+	for (i = 0; i < n_threads; ++i) pthread_join(tid[i], 0);
+	for (i = 0; i < n_threads; ++i) {
+		dfsstack_t *s = &d.q[i].s;
+		if (dfs_verbose >= 4 && chunk > 0)
+			fprintf(stderr, "[M::%s] thread %d stole %ld times\n", __func__, i, d.q[i].n_steals);
+		pthread_mutex_destroy(&d.q[i].lock);
+		free(s->st.a); free(s->sv.a); free(s->sp.a);
+	}
+	pthread_mutex_destroy(&d.lock);
+	free(d.q); free((void*)d.n_pend); free(d.done);
 }
 
 /*************
  *** Count ***
  *************/
 
+/* The binary k-mer database (-d) is laid out as:
+ *
+ *   "FKD\1", int32 k, int32 n_cnt, int32 suf_len, int32 sample
+ *   records of suffix 0, records of suffix 1, ...
+ *   uint64 seg[n_suf+1]       offset of the records of each suffix
+ *   uint64 cum[n_suf+1]       number of records before each suffix
+ *   uint64 samp[]             offset of every sample-th record of each suffix
+ *   uint64 off                offset of seg[]
+ *
+ * A record is a k-mer packed in (k+3)/4 bytes, 2 bits per base with the first
+ * base at the highest bits, followed by n_cnt LEB128-encoded counts. Records
+ * of a suffix are sorted by k-mer, and suffixes are sorted, too. */
+
+#define FKD_MAGIC "FKD\1"
+#define FKD_SAMPLE 64
+
+static inline void dfs_kdb_put_kmer(kstring_t *s, int k, const char *path)
+{
+	extern unsigned char seq_nt6_table[128];
+	int i, nb = (k + 3) >> 2;
+	uint8_t *p;
+	ks_resize(s, s->l + nb + 1);
+	p = (uint8_t*)s->s + s->l;
+	memset(p, 0, nb);
+	for (i = 0; i < k; ++i)
+		p[i>>2] |= (seq_nt6_table[(int)path[i]] - 1) << (3 - (i&3)) * 2;
+	s->l += nb;
+	s->s[s->l] = 0;
+}
+
+static inline void dfs_kdb_put_cnt(kstring_t *s, uint64_t x)
+{
+	for (; x >= 0x80; x >>= 7) kputc((x & 0x7f) | 0x80, s);
+	kputc(x, s);
+}
+
+typedef struct {
+	kstring_t s; // lines of one suffix; sorted by k-mer when all of them are added
+	kvec_t(uint64_t) beg; // where each line starts in s; after sorting, where every FKD_SAMPLE-th line starts
+	uint64_t n; // number of lines
+	int done;
+	pthread_mutex_t lock;
+} dfs_bucket_t;
+
+#define DFS_HIST_DENSE 0x4000
+
+typedef struct { // occurrence histogram of one k in one thread
+	uint64_t *a; // a[occ] for occ < DFS_HIST_DENSE
+	khash_t(64) *h; // larger occurrences
+} dfs_hist_t;
+
 typedef struct {
 	const rld_t *e;
-	int len, min_occ, bidir, bifur_only;
-	kstring_t *str;
+	int len, min_occ, bidir, bifur_only, suf_len, is_half;
+	int n_k, *kidx; // for -H: kidx[k] is the index of k in the list, or -1
+	dfs_hist_t *hist; // for -H: hist[tid*n_k+i] is the histogram of the i-th k
+	kstring_t *str; // per-thread line buffers
+	long n_suf, win;
+	volatile long n_written; // number of suffixes written
+	dfs_bucket_t *b; // per-suffix output; written in the order of suffixes by dfs_count_writer()
+	pthread_mutex_t lock;
+	pthread_cond_t cv; // signals a finished bucket or a written one
+	fm_gzw_t *out;
+	FILE *fp_db; // binary output
+	uint64_t off;
+	kvec_t(uint64_t) seg, cum, samp; // index of the binary output
 } dfs_count_t;
 
+typedef struct {
+	const char *key;
+	int l_key;
+	uint64_t beg, len;
+} dfsline_t;
+
+#define dfsline_lt(a, b) (memcmp((a).key, (b).key, (a).l_key) < 0) // k-mers are distinct and of the same length
+KSORT_INIT(dfsline, dfsline_t, dfsline_lt)
+KSORT_INIT_GENERIC(int)
+
+static void dfs_count_add(dfs_count_t *d, const char *path, kstring_t *s)
+{ // move the line in s to the bucket of the suffix of path
+	extern unsigned char seq_nt6_table[128];
+	int i, l = strlen(path);
+	long suf = 0;
+	dfs_bucket_t *b;
+	for (i = 0; i < d->suf_len; ++i)
+		suf |= (long)(seq_nt6_table[(int)path[l - 1 - i]] - 1) << i*2;
+	b = &d->b[suf];
+	pthread_mutex_lock(&b->lock); // only contended when a subtree has been stolen
+	kv_push(uint64_t, b->beg, b->s.l);
+	kputsn(s->s, s->l, &b->s);
+	pthread_mutex_unlock(&b->lock);
+	s->l = 0;
+}
+
+static void dfs_count_end(void *data, int tid, long suf)
+{ // sort the lines of a finished suffix, so that the output does not depend on threading
+	dfs_count_t *d = (dfs_count_t*)data;
+	dfs_bucket_t *b = &d->b[suf];
+	b->n = b->beg.n;
+	if (b->n > 1) {
+		size_t i;
+		dfsline_t *a;
+		kstring_t t = {0,0,0};
+		a = malloc(b->n * sizeof(dfsline_t));
+		for (i = 0; i < b->n; ++i) {
+			dfsline_t *p = &a[i];
+			p->beg = b->beg.a[i];
+			p->len = (i + 1 < b->n? b->beg.a[i+1] : b->s.l) - p->beg;
+			p->key = b->s.s + p->beg;
+			p->l_key = d->fp_db? (d->len + 3) >> 2 : d->len;
+			if (d->bidir && d->fp_db == 0) p->key = strchr(p->key, '\t') + 1; // k-mer in the second column
+		}
+		ks_introsort(dfsline, b->n, a);
+		ks_resize(&t, b->s.l + 1);
+		for (i = 0, b->beg.n = 0; i < b->n; ++i) {
+			if (i % FKD_SAMPLE == 0) b->beg.a[b->beg.n++] = t.l;
+			kputsn(b->s.s + a[i].beg, a[i].len, &t);
+		}
+		free(a); free(b->s.s);
+		b->s = t;
+	}
+	pthread_mutex_lock(&d->lock);
+	b->done = 1;
+	pthread_cond_broadcast(&d->cv);
+	while (suf >= d->n_written + d->win) // don't run ahead of a slow output; fm_dfs() keeps suf close to the oldest unfinished suffix
+		pthread_cond_wait(&d->cv, &d->lock);
+	pthread_mutex_unlock(&d->lock);
+}
+
+static void *dfs_count_writer(void *data)
+{
+	dfs_count_t *d = (dfs_count_t*)data;
+	long i;
+	for (i = 0; i < d->n_suf; ++i) {
+		dfs_bucket_t *b = &d->b[i];
+		pthread_mutex_lock(&d->lock);
+		while (!b->done) pthread_cond_wait(&d->cv, &d->lock);
+		pthread_mutex_unlock(&d->lock);
+		if (d->fp_db) {
+			size_t j;
+			uint64_t cum = d->cum.a[d->cum.n-1] + b->n;
+			kv_push(uint64_t, d->seg, d->off);
+			kv_push(uint64_t, d->cum, cum);
+			for (j = 0; j < b->beg.n; ++j)
+				kv_push(uint64_t, d->samp, d->off + b->beg.a[j]);
+			fwrite(b->s.s, 1, b->s.l, d->fp_db);
+			d->off += b->s.l;
+		} else if (b->s.l) fm_gzwrite(d->out, b->s.s, b->s.l);
+		free(b->s.s); free(b->beg.a);
+		b->s.s = 0, b->s.l = b->s.m = 0, b->beg.a = 0;
+		pthread_mutex_lock(&d->lock);
+		d->n_written = i + 1;
+		pthread_cond_broadcast(&d->cv);
+		pthread_mutex_unlock(&d->lock);
+	}
+	return 0;
+}
+
+static void dfs_kdb_write_hdr(dfs_count_t *d)
+{
+	int32_t x[4];
+	x[0] = d->len, x[1] = d->bidir? 12 : 1, x[2] = d->suf_len, x[3] = FKD_SAMPLE;
+	fwrite(FKD_MAGIC, 1, 4, d->fp_db);
+	fwrite(x, 4, 4, d->fp_db);
+	d->off = 4 + 4 * 4;
+	kv_push(uint64_t, d->cum, 0);
+}
+
+static int dfs_kdb_write_idx(dfs_count_t *d)
+{
+	uint64_t off = d->off;
+	kv_push(uint64_t, d->seg, d->off);
+	fwrite(d->seg.a, 8, d->seg.n, d->fp_db);
+	fwrite(d->cum.a, 8, d->cum.n, d->fp_db);
+	fwrite(d->samp.a, 8, d->samp.n, d->fp_db);
+	fwrite(&off, 8, 1, d->fp_db);
+	free(d->seg.a); free(d->cum.a); free(d->samp.a);
+	return ferror(d->fp_db)? -1 : 0;
+}
+
+static void dfs_hist_add(dfs_count_t *d, int tid, int k, const char *path, uint64_t occ)
+{ // without is_half, each k-mer is seen on both strands; count it in halves unless it is palindromic
+	extern unsigned char seq_nt6_table[128];
+	dfs_hist_t *h = &d->hist[tid * d->n_k + d->kidx[k]];
+	int i, w = 2;
+	if (!d->is_half) {
+		for (i = 0; i < k>>1; ++i)
+			if (seq_nt6_table[(int)path[i]] != 5 - seq_nt6_table[(int)path[k-1-i]]) break;
+		if ((k&1) || i < k>>1) w = 1;
+	}
+	if (occ < DFS_HIST_DENSE) h->a[occ] += w;
+	else {
+		int absent;
+		khint_t itr = kh_put(64, h->h, occ, &absent);
+		if (absent) kh_val(h->h, itr) = 0;
+		kh_val(h->h, itr) += w;
+	}
+}
+
+static void dfs_hist_print(dfs_count_t *d, int n_threads, const int *ks)
+{ // merge per-thread histograms and print "k occ count" lines
+	extern void ks_introsort_uint64_t(size_t n, uint64_t a[]);
+	int i, t;
+	kstring_t s = {0,0,0};
+	for (i = 0; i < d->n_k; ++i) {
+		dfs_hist_t *h0 = &d->hist[i];
+		uint64_t occ, *big;
+		khint_t itr;
+		size_t j, n_big = 0;
+		for (t = 1; t < n_threads; ++t) {
+			dfs_hist_t *h = &d->hist[t * d->n_k + i];
+			for (occ = 0; occ < DFS_HIST_DENSE; ++occ)
+				h0->a[occ] += h->a[occ];
+			for (itr = 0; itr != kh_end(h->h); ++itr) {
+				int absent;
+				khint_t k;
+				if (!kh_exist(h->h, itr)) continue;
+				k = kh_put(64, h0->h, kh_key(h->h, itr), &absent);
+				if (absent) kh_val(h0->h, k) = 0;
+				kh_val(h0->h, k) += kh_val(h->h, itr);
+			}
+		}
+		for (occ = 0; occ < DFS_HIST_DENSE; ++occ) {
+			if (h0->a[occ] == 0) continue;
+			kputw(ks[i], &s); kputc('\t', &s); kputl(occ, &s); kputc('\t', &s); kputl(h0->a[occ]>>1, &s); kputc('\n', &s);
+		}
+		big = malloc(kh_size(h0->h) * sizeof(uint64_t) + 1);
+		for (itr = 0; itr != kh_end(h0->h); ++itr)
+			if (kh_exist(h0->h, itr)) big[n_big++] = kh_key(h0->h, itr);
+		ks_introsort(uint64_t, n_big, big);
+		for (j = 0; j < n_big; ++j) {
+			itr = kh_get(64, h0->h, big[j]);
+			kputw(ks[i], &s); kputc('\t', &s); kputl(big[j], &s); kputc('\t', &s); kputl(kh_val(h0->h, itr)>>1, &s); kputc('\n', &s);
+		}
+		free(big);
+		fm_gzwrite(d->out, s.s, s.l);
+		s.l = 0;
+	}
+	free(s.s);
+}
+
 static void dfs_count(void *data, int tid, int k, char *path, const fmint6_t *size, int *cont)
 {
 	dfs_count_t *d = (dfs_count_t*)data;
 	int c;
 	uint64_t sum = 0;
+	kstring_t *s = &d->str[tid];
 	for (c = 0; c < 6; ++c) {
 		if (size->c[c] < d->min_occ) *cont &= ~(1<<c);
 		sum += size->c[c];
 	}
+	if (d->hist) {
+		if (d->kidx[k] >= 0) dfs_hist_add(d, tid, k, path, sum);
+		return;
+	}
 	if (k < d->len) return;
-	printf("%s\t%ld\n", path, (long)sum);
+	if (d->fp_db) {
+		dfs_kdb_put_kmer(s, k, path);
+		dfs_kdb_put_cnt(s, sum);
+	} else {
+		kputs(path, s); kputc('\t', s); kputl(sum, s); kputc('\n', s);
+	}
+	dfs_count_add(d, path, s);
 }
 
 static void dfs_count2(void *data, int tid, int k, char *path, const rldintv_t *ik, const rldintv_t *ok, int *cont)
@@ -220,7 +773,15 @@ static void dfs_count2(void *data, int tid, int k, char *path, const rldintv_t *
 			if (ok[c].x[2]) ++n[1];
 		if (n[0] < 2 && n[1] < 2) return; // no bifurcation; don't print
 	}
-	s->l = 0;
+	if (d->fp_db) {
+		dfs_kdb_put_kmer(s, k, path);
+		for (c = 0; c < 6; ++c) dfs_kdb_put_cnt(s, ok[c].x[2]);
+		dfs_kdb_put_cnt(s, rk[0].x[2]);
+		for (c = 4; c >= 1; --c) dfs_kdb_put_cnt(s, rk[c].x[2]);
+		dfs_kdb_put_cnt(s, rk[5].x[2]);
+		dfs_count_add(d, path, s);
+		return;
+	}
 	for (c = 0; c < 6; ++c) {
 		if (c) kputc(':', s);
 		kputl(ok[c].x[2], s);
@@ -232,22 +793,53 @@ static void dfs_count2(void *data, int tid, int k, char *path, const rldintv_t *
 		kputl(rk[c].x[2], s);
 	}
 	kputc(':', s); kputl(rk[5].x[2], s);
-	puts(s->s);
+	kputc('\n', s);
+	dfs_count_add(d, path, s);
 }
 
 int main_count(int argc, char *argv[])
 {
-	int i, c, n_threads = 1;
+	int i, c, n_threads = 1, chunk = 64, ret = 0, *ks = 0;
+	char *fn_out = 0, *fn_db = 0;
 	dfs_count_t d;
 	rld_t *e;
+	pthread_t writer;
 	memset(&d, 0, sizeof(dfs_count_t));
 	d.len = 51, d.min_occ = 1;
-	while ((c = getopt(argc, argv, "2bk:o:t:")) >= 0) {
+	while ((c = getopt(argc, argv, "2bk:o:t:c:Z:d:H:")) >= 0) {
 		if (c == 'k') d.len = atoi(optarg);
 		else if (c == 'o') d.min_occ = atoi(optarg);
 		else if (c == 't') n_threads = atoi(optarg);
 		else if (c == '2') d.bidir = 1;
 		else if (c == 'b') d.bifur_only = d.bidir = 1;
+		else if (c == 'c') chunk = atoi(optarg);
+		else if (c == 'Z') fn_out = optarg;
+		else if (c == 'd') fn_db = optarg;
+		else if (c == 'H') {
+			char *p = optarg, *q;
+			while (*p) {
+				int k = strtol(p, &q, 10);
+				if (q == p || k <= 0) break;
+				ks = realloc(ks, (d.n_k + 1) * sizeof(int));
+				ks[d.n_k++] = k;
+				p = *q == ',' ? q + 1 : q;
+			}
+			if (*p || d.n_k == 0) {
+				fprintf(stderr, "[E::%s] failed to parse the list of k: '%s'\n", __func__, optarg);
+				return 1;
+			}
+		}
+	}
+	if (fn_db && fn_out) {
+		fprintf(stderr, "[E::%s] -d can't be used with -Z\n", __func__);
+		return 1;
+	}
+	if (d.n_k > 0) { // histograms are computed from unidirectional counts
+		if (fn_db) {
+			fprintf(stderr, "[E::%s] -H can't be used with -d\n", __func__);
+			return 1;
+		}
+		d.bidir = d.bifur_only = 0;
 	}
 	if (d.bifur_only && d.min_occ < 2) d.min_occ = 2; // in the -b mode, we need to see at least 2 k-mers
 	if (optind == argc) {
@@ -256,22 +848,290 @@ int main_count(int argc, char *argv[])
 		fprintf(stderr, "Options: -k INT      k-mer length [%d]\n", d.len);
 		fprintf(stderr, "         -o INT      min occurence [%d]\n", d.min_occ);
 		fprintf(stderr, "         -t INT      number of threads [%d]\n", n_threads);
+		fprintf(stderr, "         -c INT      expand INT nodes at a time and balance threads by work stealing; 0 for plain DFS [%d]\n", chunk);
 		fprintf(stderr, "         -b          only print bifurcating k-mers (force -2)\n");
 		fprintf(stderr, "         -2          bidirectional counting\n");
+		fprintf(stderr, "         -Z FILE     write k-mers to FILE in the BGZF format [stdout]\n");
+		fprintf(stderr, "         -d FILE     write k-mers to FILE as a sorted and indexed binary database (see `fermi2 kdb')\n");
+		fprintf(stderr, "         -H STR      print occurrence histograms for comma-separated k in one traversal (override -k/-2/-b)\n");
 		fprintf(stderr, "\n");
 		return 1;
 	}
+	if (fn_db) d.fp_db = fopen(fn_db, "wb");
+	else d.out = fm_gzwopen(fn_out, n_threads);
+	if (d.fp_db == 0 && d.out == 0) {
+		fprintf(stderr, "[E::%s] failed to create the output file\n", __func__);
+		return 1;
+	}
 	d.str = calloc(n_threads, sizeof(kstring_t));
 	d.e = e = rld_restore(argv[optind]);
+	if (d.n_k > 0) {
+		ks_introsort(int, d.n_k, ks);
+		for (i = 1, c = 1; i < d.n_k; ++i) // drop duplicates
+			if (ks[i] != ks[c-1]) ks[c++] = ks[i];
+		d.n_k = c, d.len = ks[d.n_k-1];
+		d.is_half = (d.n_k == 1 && (d.len&1)); // with more k, the cut at d.len>>1 would not halve shorter k-mers
+		if (ks[0] < fm_dfs_suf_len(d.len)) {
+			fprintf(stderr, "[E::%s] with the largest k at %d, k must be at least %d\n", __func__, d.len, fm_dfs_suf_len(d.len));
+			free(ks); free(d.str); rld_destroy(e); fm_gzwclose(d.out);
+			return 1;
+		}
+		d.kidx = malloc((d.len + 1) * sizeof(int));
+		for (i = 0; i <= d.len; ++i) d.kidx[i] = -1;
+		for (i = 0; i < d.n_k; ++i) d.kidx[ks[i]] = i;
+		d.hist = calloc(n_threads * d.n_k, sizeof(dfs_hist_t));
+		for (i = 0; i < n_threads * d.n_k; ++i) {
+			d.hist[i].a = calloc(DFS_HIST_DENSE, 8);
+			d.hist[i].h = kh_init(64);
+		}
+		fm_dfs(1, &e, d.is_half, d.len, n_threads, chunk, dfs_count, 0, 0, &d);
+		dfs_hist_print(&d, n_threads, ks);
+		for (i = 0; i < n_threads * d.n_k; ++i) {
+			free(d.hist[i].a);
+			kh_destroy(64, d.hist[i].h);
+		}
+		free(d.hist); free(d.kidx); free(ks); free(d.str);
+		rld_destroy(e);
+		return fm_gzwclose(d.out) < 0? 1 : 0;
+	}
 	if (!(d.len&1)) {
 		++d.len;
 		if (dfs_verbose >= 2)
 			fprintf(stderr, "[W::%s] %d is an even number; change k to %d\n", __func__, d.len-1, d.len);
 	}
-	if (d.bidir) fm_dfs(1, &e, 1, d.len, n_threads, 0, dfs_count2, &d);
-	else fm_dfs(1, &e, 1, d.len, n_threads, dfs_count, 0, &d);
+	d.suf_len = fm_dfs_suf_len(d.len);
+	d.n_suf = 1L<<d.suf_len*2;
+	d.win = (long)n_threads * DFS_WINDOW;
+	d.b = calloc(d.n_suf, sizeof(dfs_bucket_t));
+	if (d.fp_db) dfs_kdb_write_hdr(&d);
+	for (i = 0; i < d.n_suf; ++i) pthread_mutex_init(&d.b[i].lock, 0);
+	pthread_mutex_init(&d.lock, 0);
+	pthread_cond_init(&d.cv, 0);
+	pthread_create(&writer, 0, dfs_count_writer, &d);
+	if (d.bidir) fm_dfs(1, &e, 1, d.len, n_threads, chunk, 0, dfs_count2, dfs_count_end, &d);
+	else fm_dfs(1, &e, 1, d.len, n_threads, chunk, dfs_count, 0, dfs_count_end, &d);
+	pthread_join(writer, 0);
 	rld_destroy(e);
+	for (i = 0; i < d.n_suf; ++i) pthread_mutex_destroy(&d.b[i].lock);
+	pthread_mutex_destroy(&d.lock);
+	pthread_cond_destroy(&d.cv);
 	for (i = 0; i < n_threads; ++i) free(d.str[i].s);
-	free(d.str);
+	free(d.str); free(d.b);
+	if (d.fp_db) {
+		if (dfs_kdb_write_idx(&d) < 0) ret = 1;
+		if (fclose(d.fp_db) != 0) ret = 1;
+	} else if (fm_gzwclose(d.out) < 0) ret = 1;
+	if (ret) fprintf(stderr, "[E::%s] failed to write the output\n", __func__);
+	return ret;
+}
+
+/**************************
+ *** K-mer database I/O ***
+ **************************/
+
+typedef struct {
+	int fd, k, n_cnt, suf_len, sample;
+	long n_suf;
+	uint64_t *seg, *cum, *samp; // see the layout above dfs_kdb_put_kmer()
+	uint64_t *samp0; // index of the first sample of each suffix in samp[]
+} fm_kdb_t;
+
+void fm_kdb_close(fm_kdb_t *db)
+{
+	if (db == 0) return;
+	if (db->fd >= 0) close(db->fd);
+	free(db->seg); free(db->cum); free(db->samp); free(db->samp0);
+	free(db);
+}
+
+fm_kdb_t *fm_kdb_open(const char *fn)
+{
+	struct stat st;
+	char magic[4];
+	int32_t x[4];
+	uint64_t off, l_idx;
+	long i;
+	fm_kdb_t *db;
+
+	db = calloc(1, sizeof(fm_kdb_t));
+	if ((db->fd = open(fn, O_RDONLY)) < 0) goto open_err;
+	if (fstat(db->fd, &st) < 0 || st.st_size < 28) goto open_err;
+	if (pread(db->fd, magic, 4, 0) != 4 || strncmp(magic, FKD_MAGIC, 4) != 0) goto open_err;
+	if (pread(db->fd, x, 16, 4) != 16 || x[0] <= 0 || (x[1] != 1 && x[1] != 12) || x[2] <= 0 || x[2] > 15 || x[3] <= 0) goto open_err;
+	db->k = x[0], db->n_cnt = x[1], db->suf_len = x[2], db->sample = x[3];
+	db->n_suf = 1L<<db->suf_len*2;
+	if (pread(db->fd, &off, 8, st.st_size - 8) != 8 || off + 16 * (db->n_suf + 1) + 8 > st.st_size) goto open_err;
+	db->seg = malloc(8 * (db->n_suf + 1));
+	db->cum = malloc(8 * (db->n_suf + 1));
+	if (pread(db->fd, db->seg, 8 * (db->n_suf + 1), off) != 8 * (db->n_suf + 1)) goto open_err;
+	if (pread(db->fd, db->cum, 8 * (db->n_suf + 1), off + 8 * (db->n_suf + 1)) != 8 * (db->n_suf + 1)) goto open_err;
+	db->samp0 = malloc(8 * (db->n_suf + 1));
+	for (i = 0, db->samp0[0] = 0; i < db->n_suf; ++i) {
+		if (db->cum[i+1] < db->cum[i]) goto open_err;
+		db->samp0[i+1] = db->samp0[i] + (db->cum[i+1] - db->cum[i] + db->sample - 1) / db->sample;
+	}
+	l_idx = 8 * (2 * (db->n_suf + 1) + db->samp0[db->n_suf]);
+	if (off + l_idx + 8 != st.st_size || db->seg[db->n_suf] != off) goto open_err;
+	db->samp = malloc(8 * db->samp0[db->n_suf] + 8);
+	if (pread(db->fd, db->samp, 8 * db->samp0[db->n_suf], off + 16 * (db->n_suf + 1)) != 8 * db->samp0[db->n_suf]) goto open_err;
+	return db;
+
+open_err:
+	fprintf(stderr, "[E::%s] failed to open or invalid k-mer database '%s'\n", __func__, fn);
+	fm_kdb_close(db);
 	return 0;
 }
+
+static inline const uint8_t *fm_kdb_get_cnt(const uint8_t *p, uint64_t *x)
+{
+	int s;
+	for (*x = 0, s = 0; *p & 0x80; ++p, s += 7)
+		*x |= (uint64_t)(*p & 0x7f) << s;
+	*x |= (uint64_t)*p << s;
+	return p + 1;
+}
+
+static const uint8_t *fm_kdb_format(const fm_kdb_t *db, const uint8_t *p, int rev, kstring_t *s)
+{ // decode the record at p and print it in the text format of count; if rev, print the reverse complement
+	uint64_t x[12];
+	int i, nb = (db->k + 3) >> 2, c0 = rev? 6 : 0;
+	const uint8_t *q = p + nb;
+	for (i = 0; i < db->n_cnt; ++i)
+		q = fm_kdb_get_cnt(q, &x[i]);
+	if (db->n_cnt == 12) { // the two columns are the left and the complemented right extensions; they swap on the other strand
+		for (i = 0; i < 6; ++i) {
+			if (i) kputc(':', s);
+			kputl(x[c0 + i], s);
+		}
+		kputc('\t', s);
+	}
+	for (i = 0; i < db->k; ++i) {
+		int j = rev? db->k - 1 - i : i, c = p[j>>2] >> (3 - (j&3)) * 2 & 3;
+		kputc("ACGT"[rev? 3 - c : c], s);
+	}
+	kputc('\t', s);
+	if (db->n_cnt == 12) {
+		for (i = 0; i < 6; ++i) {
+			if (i) kputc(':', s);
+			kputl(x[(6 - c0) + i], s);
+		}
+	} else kputl(x[0], s);
+	kputc('\n', s);
+	return q;
+}
+
+int fm_kdb_get(const fm_kdb_t *db, const char *kmer, kstring_t *s)
+{ // print the record of kmer to s; return 1 if found, 0 if absent and -1 on errors
+	extern unsigned char seq_nt6_table[128];
+	int i, nb = (db->k + 3) >> 2, found = 0, rev;
+	long suf = 0;
+	uint64_t beg, end, lo, hi, m;
+	const uint64_t *samp;
+	uint8_t *key, *buf;
+	kstring_t t = {0,0,0};
+
+	if (strlen(kmer) != db->k) return 0;
+	for (i = 0; i < db->k; ++i) {
+		int c = (uint8_t)kmer[i];
+		if (c >= 128 || seq_nt6_table[c] < 1 || seq_nt6_table[c] > 4) return 0;
+	}
+	// count keeps the strand with A or C in the middle (is_half in fm_dfs()); look up that strand
+	rev = (seq_nt6_table[(int)kmer[db->k>>1]] > 2);
+	if (rev) {
+		char *r = alloca(db->k + 1);
+		for (i = 0; i < db->k; ++i)
+			r[i] = "TGCA"[seq_nt6_table[(int)kmer[db->k - 1 - i]] - 1];
+		r[db->k] = 0;
+		kmer = r;
+	}
+	for (i = 0; i < db->suf_len; ++i)
+		suf |= (long)(seq_nt6_table[(int)kmer[db->k - 1 - i]] - 1) << i*2;
+	if (db->cum[suf] == db->cum[suf+1]) return 0;
+	dfs_kdb_put_kmer(&t, db->k, kmer);
+	key = (uint8_t*)t.s;
+	// binary search for the last sample not greater than key
+	samp = db->samp + db->samp0[suf];
+	buf = malloc(nb);
+	lo = 0, hi = db->samp0[suf+1] - db->samp0[suf];
+	while (hi - lo > 1) {
+		uint64_t mid = (lo + hi) >> 1;
+		if (pread(db->fd, buf, nb, samp[mid]) != nb) goto get_err;
+		if (memcmp(buf, key, nb) <= 0) lo = mid;
+		else hi = mid;
+	}
+	// scan the records up to the next sample
+	beg = samp[lo];
+	end = db->samp0[suf] + hi < db->samp0[suf+1]? samp[hi] : db->seg[suf+1];
+	free(buf);
+	buf = malloc(end - beg);
+	if (pread(db->fd, buf, end - beg, beg) != end - beg) goto get_err;
+	for (m = 0; m < end - beg;) {
+		const uint8_t *p = buf + m;
+		int r = memcmp(p, key, nb);
+		if (r == 0) fm_kdb_format(db, p, rev, s), found = 1;
+		if (r >= 0) break;
+		p += nb;
+		for (i = 0; i < db->n_cnt; ++i)
+			while (*p++ & 0x80);
+		m = p - buf;
+	}
+	free(buf); free(t.s);
+	return found;
+
+get_err:
+	free(buf); free(t.s);
+	return -1;
+}
+
+int main_kdb(int argc, char *argv[])
+{
+	int i, c, ret = 0;
+	fm_kdb_t *db;
+	kstring_t s = {0,0,0};
+	while ((c = getopt(argc, argv, "")) >= 0);
+	if (optind == argc) {
+		fprintf(stderr, "Usage: fermi2 kdb <in.fkd> [kmer1 [kmer2 [...]]]\n");
+		fprintf(stderr, "Print all records in the k-mer database generated by `fermi2 count -d', or look up the given k-mers on either strand\n");
+		return 1;
+	}
+	if ((db = fm_kdb_open(argv[optind])) == 0) return 1;
+	if (optind + 1 < argc) {
+		for (i = optind + 1; i < argc; ++i) {
+			int r;
+			s.l = 0;
+			if ((r = fm_kdb_get(db, argv[i], &s)) < 0) {
+				fprintf(stderr, "[E::%s] failed to read the k-mer database\n", __func__);
+				ret = 1;
+				break;
+			}
+			if (r == 0) { // absent; print zero counts
+				if (db->n_cnt == 12) kputs("0:0:0:0:0:0\t", &s);
+				kputs(argv[i], &s);
+				kputs(db->n_cnt == 12? "\t0:0:0:0:0:0\n" : "\t0\n", &s);
+			}
+			fputs(s.s, stdout);
+		}
+	} else { // dump the records in order
+		uint64_t off = db->seg[0], end = db->seg[db->n_suf], l_buf = 1<<20;
+		uint8_t *buf = malloc(l_buf);
+		int max_rec = ((db->k + 3) >> 2) + 10 * db->n_cnt;
+		while (off < end) {
+			uint64_t l = end - off < l_buf? end - off : l_buf, m;
+			if (pread(db->fd, buf, l, off) != l) {
+				fprintf(stderr, "[E::%s] failed to read the k-mer database\n", __func__);
+				ret = 1;
+				break;
+			}
+			for (m = 0; m < l && (off + l == end || l - m >= max_rec);) { // only decode records fully in buf
+				s.l = 0;
+				m = fm_kdb_format(db, buf + m, 0, &s) - buf;
+				fputs(s.s, stdout);
+			}
+			off += m;
+		}
+		free(buf);
+	}
+	free(s.s);
+	fm_kdb_close(db);
+	return ret;
+}
@@ -28,6 +28,11 @@ typedef struct {
 	uint64_t *ssa; // sampled suffix array
 } fmsa_t;
 
+typedef struct {
+	int st, en;
+	int occ;
+} fm_icnt_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -39,6 +44,9 @@ void fm_sa_destroy(fmsa_t *sa);
 
 int64_t fm_sa(const rld_t *e, const fmsa_t *sa, int64_t k, int64_t *si);
 void fm_exact(const rld_t *e, const char *s, int64_t *_l, int64_t *_u);
+int fmd_smem(const rld_t *e, const uint8_t *q, fmdsmem_v *mem, int min_occ, rldintv_v *curr, rldintv_v *prev);
+fm_icnt_t *fm_kprof(const rld_t *e, const char *s, int min_ext, int sat_occ, int *n_);
+int fm_query(const rld_t *e, int len, const char *s, rldintv_t *ik, rldintv_t ok[6]);
 
 #ifdef __cplusplus
 }
@@ -4,14 +4,13 @@
 */
 
 #include <math.h>
-#include <zlib.h>
+#include <unistd.h>
 #include <stdio.h>
 #include <assert.h>
 #include "priv.h"
 #include "mag.h"
 #include "kvec.h"
-#include "kseq.h"
-KSEQ_DECLARE(gzFile)
+#include "seqio.h"
 
 #include "khash.h"
 KHASH_INIT2(64,, khint64_t, uint64_t, 1, kh_int64_hash_func, kh_int64_hash_equal)
@@ -173,23 +172,31 @@ void mag_v_write(const magv_t *p, kstring_t *out)
 	kputc('\n', out);
 }
 
-void mag_g_print(const mag_t *g)
+int mag_g_write(const mag_t *g, fm_gzw_t *w)
 {
-	int i;
+	int i, ret = 0;
 	kstring_t out;
 	out.l = out.m = 0; out.s = 0;
 	for (i = 0; i < g->v.n; ++i) {
 		if (g->v.a[i].len < 0) continue;
 		mag_v_write(&g->v.a[i], &out);
-		fwrite(out.s, 1, out.l, stdout);
+		if (fm_gzwrite(w, out.s, out.l) < 0) ret = -1;
 	}
 	free(out.s);
-	fflush(stdout);
+	return ret;
+}
+
+void mag_g_print(const mag_t *g)
+{
+	fm_gzw_t *w;
+	w = fm_gzwopen(0, 1);
+	mag_g_write(g, w);
+	fm_gzwclose(w);
 }
 
 mag_t *mag_g_read(const char *fn, const magopt_t *opt)
 {
-	gzFile fp;
+	fm_gzf_t *fp;
 	kseq_t *seq;
 	ku128_v nei;
 	mag_t *g;
@@ -197,7 +204,7 @@ mag_t *mag_g_read(const char *fn, const magopt_t *opt)
 	double t;
 
 	t = cputime();
-	fp = strcmp(fn, "-")? gzopen(fn, "r") : gzdopen(fileno(stdin), "r");
+	fp = fm_gzopen(fn, 1);
 	if (fp == 0) return 0;
 	kv_init(nei);
 	g = calloc(1, sizeof(mag_t));
@@ -266,8 +273,11 @@ mag_t *mag_g_read(const char *fn, const magopt_t *opt)
 	}
 	// free and finalize the graph
 	kseq_destroy(seq);
-	gzclose(fp);
 	free(nei.a);
+	if (fm_gzclose(fp) < 0) {
+		mag_g_destroy(g);
+		return 0;
+	}
 	// finalize
 	mag_g_build_hash(g);
 	if (fm_verbose >= 3)
@@ -744,10 +754,11 @@ int main_simplify(int argc, char *argv[])
 {
 	mag_t *g;
 	int c;
-	char *s;
+	char *s, *fn_out = 0;
 	magopt_t *opt;
+	fm_gzw_t *out;
 	opt = mag_init_opt();
-	while ((c = getopt(argc, argv, "ON:d:CFAl:e:i:o:R:w:r:Sm:T:D:")) >= 0) {
+	while ((c = getopt(argc, argv, "ON:d:CFAl:e:i:o:R:w:r:Sm:T:D:Z:")) >= 0) {
 		switch (c) {
 		case 'F': opt->flag |= MAG_F_NO_AMEND | MAG_F_READ_ORI; break;
 		case 'C': opt->flag |= MAG_F_CLEAN; break;
@@ -764,6 +775,7 @@ int main_simplify(int argc, char *argv[])
 		case 'w': opt->max_bcov = atof(optarg); break;
 		case 'r': opt->max_bfrac= atof(optarg); break;
 		case 'm': opt->min_merge_len = atoi(optarg); break;
+		case 'Z': fn_out = optarg; break;
 		case 'T':
 			opt->trim_len = strtol(optarg, &s, 10);
 			if (*s == ',' || *s == ':' || *s == ';')
@@ -790,14 +802,24 @@ int main_simplify(int argc, char *argv[])
 		fprintf(stderr, "         -w FLOAT       minimum coverage to keep a bubble [%.2f]\n", opt->max_bcov);
 		fprintf(stderr, "         -r FLOAT       minimum fraction to keep a bubble [%.2f]\n\n", opt->max_bfrac);
 		fprintf(stderr, "         -T INT1[,INT2] trim INT1-bp from an open end if DP below INT2 [%d,%d]\n", opt->trim_len, opt->trim_depth);
+		fprintf(stderr, "         -Z FILE        write the graph to FILE in the BGZF format [stdout]\n");
 		fprintf(stderr, "\n");
 		return 1;
 	}
-	g = mag_g_read(argv[optind], opt);
+	if ((out = fm_gzwopen(fn_out, 1)) == 0) {
+		fprintf(stderr, "[E::%s] failed to create the output file\n", __func__);
+		free(opt);
+		return 1;
+	}
+	if ((g = mag_g_read(argv[optind], opt)) == 0) {
+		fprintf(stderr, "[E::%s] failed to read the graph\n", __func__);
+		fm_gzwclose(out); free(opt);
+		return 1;
+	}
 	mag_g_clean(g, opt);
 	mag_g_trim_open(g, opt);
-	mag_g_print(g);
+	mag_g_write(g, out);
 	mag_g_destroy(g);
 	free(opt);
-	return 0;
+	return fm_gzwclose(out) < 0? 1 : 0;
 }
@@ -47,6 +47,8 @@ typedef struct __mog_t {
 struct mogb_aux;
 typedef struct mogb_aux mogb_aux_t;
 
+struct fm_gzw_s; // defined in seqio.h
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -58,6 +60,7 @@ extern "C" {
 	mag_t *mag_g_read(const char *fn, const magopt_t *opt);
 	void mag_g_build_hash(mag_t *g);
 	void mag_g_print(const mag_t *g);
+	int mag_g_write(const mag_t *g, struct fm_gzw_s *w);
 	int mag_g_rm_vext(mag_t *g, int min_len, int min_nsr);
 	void mag_g_rm_edge(mag_t *g, int min_ovlp, double min_ratio, int min_len, int min_nsr);
 	void mag_g_merge(mag_t *g, int rmdup, int min_merge_len);
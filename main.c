@@ -9,6 +9,7 @@ int main_sub(int argc, char *argv[]);
 int main_unpack(int argc, char *argv[]);
 int main_correct(int argc, char *argv[]);
 int main_count(int argc, char *argv[]);
+int main_kdb(int argc, char *argv[]);
 int main_inspectk(int argc, char *argv[]);
 int main_interleave(int argc, char *argv[]);
 int main_assemble(int argc, char *argv[]);
@@ -16,6 +17,9 @@ int main_simplify(int argc, char *argv[]);
 int main_sa(int argc, char *argv[]);
 int main_match(int argc, char *argv[]);
 int main_kprof(int argc, char *argv[]);
+int main_query(int argc, char *argv[]);
+int main_serve(int argc, char *argv[]);
+int main_client(int argc, char *argv[]);
 
 void liftrlimit(void);
 double cputime(void);
@@ -35,12 +39,16 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "  unpack      unpack FM-index\n");
 		fprintf(stderr, "  correct     error correction\n");
 		fprintf(stderr, "  count       k-mer counting (inefficient for long k-mers)\n");
+		fprintf(stderr, "  kdb         dump or query a binary k-mer database\n");
 		fprintf(stderr, "  interleave  convert 2-file PE fastq to interleaved fastq\n");
 		fprintf(stderr, "  assemble    assemble reads into a unitig graph\n");
 		fprintf(stderr, "  simplify    simplify a unitig graph\n");
 		fprintf(stderr, "  sa          generate sampled suffix array\n");
 		fprintf(stderr, "  match       exact matches\n");
 		fprintf(stderr, "  kprof       k-mer profile\n");
+		fprintf(stderr, "  query       count k-mers and their neighbors\n");
+		fprintf(stderr, "  serve       answer queries over a Unix socket\n");
+		fprintf(stderr, "  client      send queries to a server\n");
 		return 1;
 	}
 	t_start = realtime();
@@ -50,6 +58,7 @@ int main(int argc, char *argv[])
 	else if (strcmp(argv[1], "unpack") == 0) ret = main_unpack(argc-1, argv+1);
 	else if (strcmp(argv[1], "correct") == 0) ret = main_correct(argc-1, argv+1);
 	else if (strcmp(argv[1], "count") == 0) ret = main_count(argc-1, argv+1);
+	else if (strcmp(argv[1], "kdb") == 0) ret = main_kdb(argc-1, argv+1);
 	else if (strcmp(argv[1], "inspectk") == 0) ret = main_inspectk(argc-1, argv+1);
 	else if (strcmp(argv[1], "interleave") == 0) ret = main_interleave(argc-1, argv+1);
 	else if (strcmp(argv[1], "assemble") == 0) ret = main_assemble(argc-1, argv+1);
@@ -57,6 +66,9 @@ int main(int argc, char *argv[])
 	else if (strcmp(argv[1], "sa") == 0) ret = main_sa(argc-1, argv+1);
 	else if (strcmp(argv[1], "match") == 0) ret = main_match(argc-1, argv+1);
 	else if (strcmp(argv[1], "kprof") == 0) ret = main_kprof(argc-1, argv+1);
+	else if (strcmp(argv[1], "query") == 0) ret = main_query(argc-1, argv+1);
+	else if (strcmp(argv[1], "serve") == 0) ret = main_serve(argc-1, argv+1);
+	else if (strcmp(argv[1], "client") == 0) ret = main_client(argc-1, argv+1);
 	else {
 		fprintf(stderr, "[E::%s] unknown command\n", __func__);
 		return 1;
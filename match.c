@@ -3,12 +3,10 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
-#include <zlib.h>
 #include "fermi2.h"
 #include "kvec.h"
 #include "kstring.h"
-#include "kseq.h"
-KSEQ_DECLARE(gzFile)
+#include "seqio.h"
 
 int kvsprintf(kstring_t *s, const char *fmt, va_list ap)
 {
@@ -105,11 +103,13 @@ void fm_exact(const rld_t *e, const char *s, int64_t *_l, int64_t *_u)
 {
 	extern unsigned char seq_nt6_table[128];
 	int64_t i, l = 0, u = e->mcnt[0];
+	uint64_t ok[6], ou[6];
 	for (i = strlen(s) - 1; i >= 0; --i) {
 		int c = (uint8_t)s[i];
 		c = c < 6? c : c < 128? seq_nt6_table[c] : 5;
-		l = e->cnt[c] + rld_rank11(e, l, c);
-		u = e->cnt[c] + rld_rank11(e, u, c);
+		rld_rank2a(e, l, u, ok, ou);
+		l = e->cnt[c] + ok[c];
+		u = e->cnt[c] + ou[c];
 		if (l >= u) break;
 	}
 	*_l = l, *_u = u;
@@ -122,7 +122,7 @@ extern void kt_for(int n_threads, void (*func)(void*,long,int), void *data, long
 typedef struct {
 	rldintv_v curr, prev;
 	fmdsmem_v smem;
-	kstring_t str, cmp[2];
+	kstring_t str;
 } thrmem_t;
 
 typedef struct {
@@ -134,13 +134,14 @@ typedef struct {
 	int n_threads;
 	thrmem_t *mem;
 
-	int n_seqs, m_seqs;
-	char **name, **seq, **qual, **out;
+	fm_batch_t *b;
+	int m_out;
+	char **out;
 } global_t;
 
-static void discover(const rld_t *e, const fmdsmem_t *q, const fmdsmem_t *p, int l_seq, const char *seq, const char *qual, kstring_t *s, kstring_t cmp[2])
+static void discover(const rld_t *e, const fmdsmem_t *q, const fmdsmem_t *p, int l_seq, const char *seq, const char *qual, kstring_t *s)
 {
-	int start, end, i, ext[2], left, right, tmp_l, pos;
+	int start, end, i, ext[2], left, right, tmp_l, pos, len, rev;
 	int64_t occ[2];
 	rldintv_t ovlp;
 
@@ -155,11 +156,14 @@ static void discover(const rld_t *e, const fmdsmem_t *q, const fmdsmem_t *p, int
 		start = (uint32_t)q->ik.info; end = l_seq;
 	} else {
 		start = (uint32_t)q->ik.info, end = p->ik.info>>32;
-		if (start >= end && q->ok[1][0].x[2] == q->ik.x[2] && p->ik.x[2] == p->ok[0][0].x[2]) return;
+		if (start >= end && p->ik.x[2] == p->ok[0][0].x[2]) {
+			rldintv_t ok[6]; // q->ok[1] is only needed here; compute it lazily
+			rld_extend(e, &q->ik, ok, 0);
+			if (ok[0].x[2] == q->ik.x[2]) return;
+		}
 	}
 	// find the SAI for the overlap (if applicable)
-	memset(&ovlp, 0, sizeof(rldintv_t));
-	ovlp.x[2] = e->mcnt[0];
+	fmd_empty_intv(e, ovlp);
 	if (start <= end) { // no overlap
 		left = start - 1, right = end;
 		for (i = left + 1; i < right; ++i)
@@ -168,7 +172,8 @@ static void discover(const rld_t *e, const fmdsmem_t *q, const fmdsmem_t *p, int
 	} else {
 		rldintv_t ok[6];
 		left = end - 1, right = start;
-		for (i = right - 1; i > left; --i) {
+		fmd_set_intv(e, seq[right-1], ovlp);
+		for (i = right - 2; i > left; --i) {
 			rld_extend(e, &ovlp, ok, 1);
 			ovlp = ok[(int)seq[i]];
 			assert(ovlp.x[2] > 0);
@@ -182,8 +187,7 @@ static void discover(const rld_t *e, const fmdsmem_t *q, const fmdsmem_t *p, int
 		uint64_t ol[6], ou[6];
 		for (i = left; i >= 0; --i) {
 			int c = seq[i];
-			rld_rank1a(e, l, ol);
-			rld_rank1a(e, u, ou);
+			rld_rank2a(e, l, u, ol, ou);
 			l = e->cnt[c] + ol[c];
 			u = e->cnt[c] + ou[c];
 			if (u - l <= q->ik.x[2]) break;
@@ -198,8 +202,7 @@ static void discover(const rld_t *e, const fmdsmem_t *q, const fmdsmem_t *p, int
 		uint64_t ol[6], ou[6];
 		for (i = right; i < l_seq; ++i) {
 			int c = fmd_comp(seq[i]);
-			rld_rank1a(e, l, ol);
-			rld_rank1a(e, u, ou);
+			rld_rank2a(e, l, u, ol, ou);
 			l = e->cnt[c] + ol[c];
 			u = e->cnt[c] + ou[c];
 			if (u - l <= p->ik.x[2]) break;
@@ -209,30 +212,34 @@ static void discover(const rld_t *e, const fmdsmem_t *q, const fmdsmem_t *p, int
 		occ[1] = u - l;
 	}
 	if (ovlp.x[2] == occ[0] + occ[1]) return;
-	// cut sequence
+	// choose the strand: compare the segment and its reverse complement in place
 	pos = left + 1 - ext[0];
-	cmp[0].l = cmp[1].l = 0;
-	kputsn(&seq[pos], (right + ext[1]) - (left + 1 - ext[0]), &cmp[0]);
-	kputsn(cmp[0].s, cmp[0].l, &cmp[1]);
-	seq_revcomp6(cmp[1].l, (uint8_t*)cmp[1].s);
+	len = (right + ext[1]) - pos;
+	for (i = 0, rev = 0; i < len; ++i) {
+		int a = seq[pos + i], b = fmd_comp(seq[pos + len - 1 - i]);
+		if (a != b) {
+			rev = a > b;
+			break;
+		}
+	}
 	// print
 	if (ovlp.x[2] == e->mcnt[0]) ovlp.x[2] = 0;
 	ksprintf(s, "NS\t%d\t", pos);
 	tmp_l = end < start? start - end : 0;
-	if (strcmp(cmp[0].s, cmp[1].s) <= 0) {
+	if (!rev) {
 		ksprintf(s, "+\t%d\t%d\t%d\t%ld\t%ld\t%ld\t", ext[0] + tmp_l, end - start, ext[1] + tmp_l, (long)occ[0], (long)ovlp.x[2], (long)occ[1]);
-		for (i = 0; i < cmp[0].l; ++i)
-			kputc("$ACGTN"[(int)cmp[0].s[i]], s);
+		for (i = 0; i < len; ++i)
+			kputc("$ACGTN"[(int)seq[pos + i]], s);
 		kputc('\t', s);
-		if (qual) kputsn(&qual[pos], cmp[0].l, s);
+		if (qual) kputsn(&qual[pos], len, s);
 		else kputc('*', s);
 	} else {
 		ksprintf(s, "-\t%d\t%d\t%d\t%ld\t%ld\t%ld\t", ext[1] + tmp_l, end - start, ext[0] + tmp_l, (long)occ[1], (long)ovlp.x[2], (long)occ[0]);
-		for (i = 0; i < cmp[0].l; ++i)
-			kputc("$ACGTN"[(int)cmp[1].s[i]], s);
+		for (i = pos + len - 1; i >= pos; --i)
+			kputc("$ACGTN"[fmd_comp((int)seq[i])], s);
 		kputc('\t', s);
 		if (qual) {
-			for (i = pos + cmp[0].l - 1; i >= pos; --i)
+			for (i = pos + len - 1; i >= pos; --i)
 				kputc(qual[i], s);
 		} else kputc('*', s);
 	}
@@ -243,13 +250,12 @@ static void worker(void *data, long jid, int tid)
 {
 	global_t *g = (global_t*)data;
 	thrmem_t *m = &g->mem[tid];
-	char *seq = g->seq[jid], *qual = g->qual? g->qual[jid] : 0;
-	int l_seq;
+	char *seq = g->b->seq[jid], *qual = g->b->qual[jid];
+	int l_seq = g->b->len[jid];
 
-	l_seq = strlen(seq);
 	seq_char2nt6(l_seq, (uint8_t*)seq);
 	m->str.l = 0;
-	ksprintf(&m->str, "SQ\t%s\t%d\n", g->name[jid], l_seq);
+	ksprintf(&m->str, "SQ\t%s\t%d\n", g->b->name[jid], l_seq);
 	if (!g->partial) { // full-length match
 		int64_t k, l, u;
 		fm_exact(g->e, seq, &l, &u);
@@ -274,11 +280,10 @@ static void worker(void *data, long jid, int tid)
 				fmdsmem_t *p = &m->smem.a[i];
 				int start = p->ik.info>>32, end = (uint32_t)p->ik.info;
 				if (end - start < g->kmer) continue; // skip short SMEMs
-				rld_extend(g->e, &p->ik, p->ok[1], 0);
-				discover(g->e, pre < 0? 0 : &m->smem.a[pre], p, l_seq, seq, qual, &m->str, m->cmp);
+				discover(g->e, pre < 0? 0 : &m->smem.a[pre], p, l_seq, seq, qual, &m->str);
 				pre = i;
 			}
-			discover(g->e, pre < 0? 0 : &m->smem.a[pre], 0, l_seq, seq, qual, &m->str, m->cmp);
+			discover(g->e, pre < 0? 0 : &m->smem.a[pre], 0, l_seq, seq, qual, &m->str);
 		} else {
 			for (i = 0; i < m->smem.n; ++i) {
 				fmdsmem_t *p = &m->smem.a[i];
@@ -296,22 +301,22 @@ static void worker(void *data, long jid, int tid)
 			}
 		}
 	}
-	kputsn("//", 2, &m->str);
-	free(g->qual[jid]); free(g->seq[jid]); free(g->name[jid]);
+	kputsn("//\n", 3, &m->str);
 	g->out[jid] = strdup(m->str.s);
 }
 
 int main_match(int argc, char *argv[])
 {
-	int i, c, use_mmap = 0, batch_size = 10000000, l_seqs;
-	gzFile fp;
-	char *fn_sa = 0;
+	int i, c, use_mmap = 0, batch_size = 10000000;
+	fm_gzf_t *fp;
+	char *fn_sa = 0, *fn_out = 0;
 	kseq_t *ks;
+	fm_gzw_t *out;
 	global_t g;
 
 	memset(&g, 0, sizeof(global_t));
 	g.max_sa_occ = 10, g.min_occ = 1, g.n_threads = 1, g.kmer = 61, g.min_len = 0;
-	while ((c = getopt(argc, argv, "Mdps:m:n:b:t:k:l:")) >= 0) {
+	while ((c = getopt(argc, argv, "Mdps:m:n:b:t:k:l:Z:")) >= 0) {
 		if (c == 'M') use_mmap = 1;
 		else if (c == 's') fn_sa = optarg;
 		else if (c == 'l') g.min_len = atoi(optarg);
@@ -322,6 +327,7 @@ int main_match(int argc, char *argv[])
 		else if (c == 't') g.n_threads = atoi(optarg);
 		else if (c == 'k') g.kmer = atoi(optarg), g.discovery = g.partial = 1;
 		else if (c == 'b') batch_size = atoi(optarg);
+		else if (c == 'Z') fn_out = optarg;
 	}
 
 	if (optind + 2 > argc) {
@@ -336,6 +342,7 @@ int main_match(int argc, char *argv[])
 		fprintf(stderr, "  -m INT    show coordinate if the number of hits is no more than INT [%d]\n", g.max_sa_occ);
 		fprintf(stderr, "  -n INT    min occurrences [%d]\n", g.min_occ);
 		fprintf(stderr, "  -l INT    min length [%d]\n", g.min_len);
+		fprintf(stderr, "  -Z FILE   write the output to FILE in the BGZF format [stdout]\n");
 		fprintf(stderr, "Output format:\n");
 		fprintf(stderr, "    SQ  seqName seqLen\n");
 		fprintf(stderr, "    EM  start   end     occurrence [positions]\n");
@@ -344,7 +351,7 @@ int main_match(int argc, char *argv[])
 		return 1;
 	}
 
-	fp = gzopen(argv[optind+1], "r");
+	fp = fm_gzopen(argv[optind+1], g.n_threads);
 	if (fp == 0) {
 		fprintf(stderr, "[E::%s] failed to open the sequence file\n", __func__);
 		return 1;
@@ -352,65 +359,55 @@ int main_match(int argc, char *argv[])
 	g.e = use_mmap? rld_restore_mmap(argv[optind]) : rld_restore(argv[optind]);
 	if (g.e == 0) {
 		fprintf(stderr, "[E::%s] failed to open the index file\n", __func__);
-		gzclose(fp);
+		fm_gzclose(fp);
 		return 1;
 	}
 	if (g.partial && (g.e->mcnt[2] != g.e->mcnt[5] || g.e->mcnt[3] != g.e->mcnt[4])) {
 		fprintf(stderr, "[E::%s] with '-p', the index must include both strands\n", __func__);
 		rld_destroy((rld_t*)g.e);
-		gzclose(fp);
+		fm_gzclose(fp);
 		return 1;
 	}
 	if (fn_sa) g.sa = fm_sa_restore(fn_sa);
 	if (fn_sa && g.sa == 0) {
 		fprintf(stderr, "[E::%s] failed to open the sampled SA file\n", __func__);
 		rld_destroy((rld_t*)g.e);
-		gzclose(fp);
+		fm_gzclose(fp);
 		return 1;
 	}
 
+	if ((out = fm_gzwopen(fn_out, g.n_threads)) == 0) {
+		fprintf(stderr, "[E::%s] failed to create the output file\n", __func__);
+		if (g.sa) fm_sa_destroy((fmsa_t*)g.sa);
+		rld_destroy((rld_t*)g.e);
+		fm_gzclose(fp);
+		return 1;
+	}
 	g.mem = calloc(g.n_threads, sizeof(thrmem_t));
 
 	batch_size *= g.n_threads;
 	ks = kseq_init(fp);
-	l_seqs = 0;
-	while (kseq_read(ks) >= 0) {
-		if (g.n_seqs == g.m_seqs) {
-			g.m_seqs = g.m_seqs? g.m_seqs<<1 : 4;
-			g.name = realloc(g.name, g.m_seqs * sizeof(char*));
-			g.seq  = realloc(g.seq,  g.m_seqs * sizeof(char*));
-			g.qual = realloc(g.qual, g.m_seqs * sizeof(char*));
-			g.out  = realloc(g.out,  g.m_seqs * sizeof(char*));
+	g.b = fm_batch_init();
+	while (fm_batch_read(ks, batch_size, 0, g.b) > 0) {
+		if (g.b->n > g.m_out) {
+			g.m_out = g.b->n;
+			g.out = realloc(g.out, g.m_out * sizeof(char*));
 		}
-		g.name[g.n_seqs] = strdup(ks->name.s);
-		g.seq[g.n_seqs]  = strdup(ks->seq.s);
-		g.qual[g.n_seqs] = ks->qual.l? strdup(ks->qual.s) : 0; // these will be free'd in worker
-		++g.n_seqs;
-		l_seqs += ks->seq.l;
-		if (l_seqs >= batch_size) {
-			kt_for(g.n_threads, worker, &g, g.n_seqs);
-			for (i = 0; i < g.n_seqs; ++i) {
-				puts(g.out[i]);
-				free(g.out[i]);
-			}
-			g.n_seqs = l_seqs = 0;
+		kt_for(g.n_threads, worker, &g, g.b->n);
+		for (i = 0; i < g.b->n; ++i) {
+			fm_gzwrite(out, g.out[i], strlen(g.out[i]));
+			free(g.out[i]);
 		}
 	}
-	// the last batch
-	kt_for(g.n_threads, worker, &g, g.n_seqs);
-	for (i = 0; i < g.n_seqs; ++i) {
-		puts(g.out[i]);
-		free(g.out[i]);
-	}
 	kseq_destroy(ks);
 
 	for (i = 0; i < g.n_threads; ++i) {
 		free(g.mem[i].curr.a); free(g.mem[i].prev.a); free(g.mem[i].smem.a);
-		free(g.mem[i].cmp[0].s); free(g.mem[i].cmp[1].s); free(g.mem[i].str.s);
+		free(g.mem[i].str.s);
 	}
-	free(g.name); free(g.seq); free(g.qual); free(g.out); free(g.mem);
+	fm_batch_destroy(g.b); free(g.out); free(g.mem);
 	if (g.sa) fm_sa_destroy((fmsa_t*)g.sa);
 	rld_destroy((rld_t*)g.e);
-	gzclose(fp);
-	return 0;
+	c = fm_gzclose(fp) < 0? 1 : 0;
+	return fm_gzwclose(out) < 0? 1 : c;
 }
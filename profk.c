@@ -1,11 +1,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <zlib.h>
 #include "fermi2.h"
+#include "kstring.h"
 #include "ketopt.h"
-#include "kseq.h"
-KSEQ_INIT(gzFile, gzread)
+#include "seqio.h"
 
 #define MALLOC(ptr, len) ((ptr) = (__typeof__(ptr))malloc((len) * sizeof(*(ptr))))
 
@@ -13,15 +12,16 @@ int fm_extend_to(const rld_t *e, const char *s, int x, int min_ext, int sat_occ,
 {
 	extern unsigned char seq_nt6_table[128];
 	int i, k;
-	uint64_t l = 0, u = e->mcnt[0];
+	uint64_t l = 0, u = e->mcnt[0], ok[6], ou[6];
 	*occ = 0;
 	if (x + 1 - min_ext < 0) return 0;
 	for (i = x, k = 0; i >= 0; --i) {
 		int c = (uint8_t)s[i];
 		uint64_t l0 = l, u0 = u;
 		c = c < 6? c : c < 128? seq_nt6_table[c] : 5;
-		l = e->cnt[c] + rld_rank11(e, l, c);
-		u = e->cnt[c] + rld_rank11(e, u, c);
+		rld_rank2a(e, l, u, ok, ou);
+		l = e->cnt[c] + ok[c];
+		u = e->cnt[c] + ou[c];
 		if (l >= u) break; // can't be extended
 		++k;
 		if (sat_occ > 0) {
@@ -37,18 +37,60 @@ int fm_extend_to(const rld_t *e, const char *s, int x, int min_ext, int sat_occ,
 	return k;
 }
 
-typedef struct {
-	int st, en;
-	int occ;
-} fm_icnt_t;
-
-fm_icnt_t *fm_kprof(const rld_t *e, const char *s, int min_ext, int sat_occ, int *n_)
+static inline int kp_nt6(const char *s, int i)
 {
-	int i, x, len, k = 0;
+	extern unsigned char seq_nt6_table[128];
+	int c = (uint8_t)s[i];
+	return c < 6? c : c < 128? seq_nt6_table[c] : 5;
+}
+
+static int fm_kprof_bidir(const rld_t *e, const char *s, int lo, int hi, int k, fm_icnt_t *a)
+{ // k-mer occurrences of all windows ending at [lo,hi), requiring a bidirectional index
+	int h, b, t, i, j, n = 0;
+	rldintv_t ik, ok[6], *r;
+	for (h = 1; h * h < k<<1; ++h); // a block of h windows costs k+h(h-1)/2 extensions
+	if (h > k) h = k;
+	r = (rldintv_t*)alloca(h * sizeof(rldintv_t));
+	for (t = hi - 1; t >= lo; t = b - 1) {
+		int m; // number of computed R_j
+		b = t - h + 1 > lo? t - h + 1 : lo;
+		// the core s[t-k+1..b], shared by all windows in the block
+		fmd_set_intv(e, kp_nt6(s, b), ik);
+		for (i = b - 1; i >= t - k + 1 && ik.x[2]; --i) {
+			rld_extend(e, &ik, ok, 1);
+			ik = ok[kp_nt6(s, i)];
+		}
+		// R_j = s[t-k+1..b+j] by forward extension
+		for (m = 1, r[0] = ik; m <= t - b && r[m-1].x[2]; ++m) {
+			rld_extend(e, &r[m-1], ok, 0);
+			r[m] = ok[fmd_comp(kp_nt6(s, b + m))];
+		}
+		// extend R_j backward to s[b+j-k+1]
+		for (j = t - b; j >= 0; --j, ++n) {
+			a[n].st = b + j + 1 - k, a[n].en = b + j + 1, a[n].occ = 0;
+			if (j >= m) continue;
+			ik = r[j];
+			for (i = t - k; i >= b + j - k + 1 && ik.x[2]; --i) {
+				rld_extend(e, &ik, ok, 1);
+				ik = ok[kp_nt6(s, i)];
+			}
+			a[n].occ = ik.x[2];
+		}
+	}
+	return n;
+}
+
+static fm_icnt_t *fm_kprof_core(const rld_t *e, const char *s, int lo, int hi, int min_ext, int sat_occ, int *n_)
+{ // profile windows ending at [lo,hi), starting from hi-1; results are in the descending order
+	int x, k = 0;
 	fm_icnt_t *a;
-	len = strlen(s);
-	MALLOC(a, len);
-	for (x = len - 1; x >= min_ext - 1;) {
+	if (lo < min_ext - 1) lo = min_ext - 1;
+	MALLOC(a, hi > lo? hi - lo : 1);
+	if (sat_occ <= 0 && e->mcnt[2] == e->mcnt[5] && e->mcnt[3] == e->mcnt[4]) { // every window is visited
+		*n_ = hi > lo? fm_kprof_bidir(e, s, lo, hi, min_ext, a) : 0;
+		return a;
+	}
+	for (x = hi - 1; x >= lo;) {
 		int y, occ;
 		y = fm_extend_to(e, s, x, min_ext, sat_occ, &occ);
 		a[k].st = x + 1 - (y >= min_ext? y : min_ext);
@@ -57,6 +99,15 @@ fm_icnt_t *fm_kprof(const rld_t *e, const char *s, int min_ext, int sat_occ, int
 		x -= (y >= min_ext? y - min_ext : 0) + 1;
 	}
 	*n_ = k;
+	return a;
+}
+
+fm_icnt_t *fm_kprof(const rld_t *e, const char *s, int min_ext, int sat_occ, int *n_)
+{
+	int i, k;
+	fm_icnt_t *a;
+	a = fm_kprof_core(e, s, 0, strlen(s), min_ext, sat_occ, &k);
+	*n_ = k;
 	for (i = 0; i < k>>1; ++i) {
 		fm_icnt_t t = a[i];
 		a[i] = a[k - i - 1]; a[k - i - 1] = t;
@@ -64,44 +115,171 @@ fm_icnt_t *fm_kprof(const rld_t *e, const char *s, int min_ext, int sat_occ, int
 	return a;
 }
 
+/*****************
+ * Batch profile *
+ *****************/
+
+#define KP_CHUNK_SIZE 0x10000
+
+extern void kt_for(int n_threads, void (*func)(void*,long,int), void *data, long n);
+
+typedef struct {
+	int lo, hi; // windows ending at [lo,hi)
+	int n;
+	fm_icnt_t *a;
+} kpchunk_t;
+
+typedef struct {
+	const rld_t *e;
+	int min_ext, sat_occ;
+	int n_threads;
+
+	fm_batch_t *b;
+	int m_seqs, n_chunks, m_chunks;
+	int *c_st; // c_st[i]: index of the first chunk of sequence i; c_st[b->n] = n_chunks
+	char **out;
+	kpchunk_t *chunk;
+	int *c2s; // chunk-to-sequence
+} kpglobal_t;
+
+static void kp_chunk_worker(void *data, long jid, int tid)
+{
+	kpglobal_t *g = (kpglobal_t*)data;
+	kpchunk_t *c = &g->chunk[jid];
+	c->a = fm_kprof_core(g->e, g->b->seq[g->c2s[jid]], c->lo, c->hi, g->min_ext, g->sat_occ, &c->n);
+}
+
+static void kp_seq_worker(void *data, long jid, int tid)
+{ // stitch chunks; the right-to-left chain is followed until it joins the chain of a chunk
+	kpglobal_t *g = (kpglobal_t*)data;
+	const char *s = g->b->seq[jid];
+	int i, j, x, n = 0, m = 0;
+	fm_icnt_t *a = 0;
+	kstring_t str = {0,0,0};
+
+	for (j = g->c_st[jid+1] - 1, x = g->b->len[jid] - 1; j >= g->c_st[jid]; --j) {
+		kpchunk_t *c = &g->chunk[j];
+		i = 0;
+		while (x >= c->lo) {
+			int y, occ;
+			while (i < c->n && c->a[i].en - 1 > x) ++i;
+			if (i < c->n && c->a[i].en - 1 == x) { // joined; the rest of the chunk is on the chain
+				if (n + c->n - i > m) {
+					m = n + c->n - i;
+					kroundup32(m);
+					a = (fm_icnt_t*)realloc(a, m * sizeof(fm_icnt_t));
+				}
+				memcpy(&a[n], &c->a[i], (c->n - i) * sizeof(fm_icnt_t));
+				n += c->n - i;
+				x = a[n-1].st + g->min_ext - 2; // the next window; always below c->lo
+				break;
+			}
+			if (n == m) {
+				m = m? m<<1 : 16;
+				a = (fm_icnt_t*)realloc(a, m * sizeof(fm_icnt_t));
+			}
+			y = fm_extend_to(g->e, s, x, g->min_ext, g->sat_occ, &occ);
+			a[n].st = x + 1 - (y >= g->min_ext? y : g->min_ext);
+			a[n].en = x + 1;
+			a[n++].occ = occ;
+			x -= (y >= g->min_ext? y - g->min_ext : 0) + 1;
+		}
+		free(c->a);
+	}
+	for (i = n - 1; i >= 0; --i) {
+		kputs(g->b->name[jid], &str); kputc('\t', &str);
+		kputw(a[i].st, &str); kputc('\t', &str);
+		kputw(a[i].en, &str); kputc('\t', &str);
+		kputw(a[i].occ, &str); kputc('\n', &str);
+	}
+	free(a);
+	g->out[jid] = str.s;
+}
+
+static void kp_process(kpglobal_t *g)
+{
+	int i;
+	kt_for(g->n_threads, kp_chunk_worker, g, g->n_chunks);
+	kt_for(g->n_threads, kp_seq_worker, g, g->b->n);
+	for (i = 0; i < g->b->n; ++i) {
+		if (g->out[i]) fputs(g->out[i], stdout);
+		free(g->out[i]);
+	}
+	g->n_chunks = 0;
+}
+
 int main_kprof(int argc, char *argv[])
 {
 	ketopt_t o = KETOPT_INIT;
-	int c, min_ext = 61, sat_occ = 0;
-	rld_t *e;
+	int i, c, use_mmap = 0, batch_size = 10000000;
+	kpglobal_t g;
 	kseq_t *ks;
-	gzFile fp;
+	fm_gzf_t *fp;
 
-	while ((c = ketopt(&o, argc, argv, 1, "k:c:", 0)) >= 0) {
-		if (c == 'k') min_ext = atoi(o.arg);
-		else if (c == 'c') sat_occ = atoi(o.arg);
+	memset(&g, 0, sizeof(kpglobal_t));
+	g.min_ext = 61, g.n_threads = 1;
+	while ((c = ketopt(&o, argc, argv, 1, "k:c:t:b:M", 0)) >= 0) {
+		if (c == 'k') g.min_ext = atoi(o.arg);
+		else if (c == 'c') g.sat_occ = atoi(o.arg);
+		else if (c == 't') g.n_threads = atoi(o.arg);
+		else if (c == 'b') batch_size = atoi(o.arg);
+		else if (c == 'M') use_mmap = 1;
 	}
 	if (argc - o.ind < 2) {
 		fprintf(stderr, "Usage: fermi2 kprof [options] <in.fmd> <in.fa>\n");
 		fprintf(stderr, "Options:\n");
-		fprintf(stderr, "  -k INT    min k-mer size [%d]\n", min_ext);
-		fprintf(stderr, "  -c INT    occurrence saturation [%d]\n", sat_occ);
+		fprintf(stderr, "  -k INT    min k-mer size [%d]\n", g.min_ext);
+		fprintf(stderr, "  -c INT    occurrence saturation [%d]\n", g.sat_occ);
+		fprintf(stderr, "  -t INT    number of threads [%d]\n", g.n_threads);
+		fprintf(stderr, "  -b INT    batch size [%d]\n", batch_size);
+		fprintf(stderr, "  -M        load the index with mmap\n");
 		return 1;
 	}
 
-	fp = gzopen(argv[o.ind+1], "r");
+	fp = fm_gzopen(argv[o.ind+1], g.n_threads);
 	if (fp == 0) {
 		fprintf(stderr, "[E::%s] failed to open the sequence file\n", __func__);
 		return 1;
 	}
+	g.e = use_mmap? rld_restore_mmap(argv[o.ind]) : rld_restore(argv[o.ind]);
+	if (g.e == 0) {
+		fprintf(stderr, "[E::%s] failed to open the index file\n", __func__);
+		fm_gzclose(fp);
+		return 1;
+	}
+
+	batch_size *= g.n_threads;
 	ks = kseq_init(fp);
-	e = rld_restore(argv[o.ind]);
-
-	while (kseq_read(ks) >= 0) {
-		int i, n_a;
-		fm_icnt_t *a;
-		a = fm_kprof(e, ks->seq.s, min_ext, sat_occ, &n_a);
-		for (i = 0; i < n_a; ++i)
-			fprintf(stdout, "%s\t%d\t%d\t%d\n", ks->name.s, a[i].st, a[i].en, a[i].occ);
-		free(a);
+	g.b = fm_batch_init();
+	while (fm_batch_read(ks, batch_size, 0, g.b) > 0) {
+		if (g.b->n + 1 > g.m_seqs) {
+			g.m_seqs = g.b->n + 1;
+			g.out  = realloc(g.out,  g.m_seqs * sizeof(char*));
+			g.c_st = realloc(g.c_st, g.m_seqs * sizeof(int));
+		}
+		for (i = 0; i < g.b->n; ++i) {
+			int lo, len = g.b->len[i];
+			g.c_st[i] = g.n_chunks;
+			for (lo = g.min_ext - 1; lo < len; lo += KP_CHUNK_SIZE) { // split long sequences
+				kpchunk_t *p;
+				if (g.n_chunks == g.m_chunks) {
+					g.m_chunks = g.m_chunks? g.m_chunks<<1 : 4;
+					g.chunk = realloc(g.chunk, g.m_chunks * sizeof(kpchunk_t));
+					g.c2s   = realloc(g.c2s,   g.m_chunks * sizeof(int));
+				}
+				g.c2s[g.n_chunks] = i;
+				p = &g.chunk[g.n_chunks++];
+				p->lo = lo, p->hi = lo + KP_CHUNK_SIZE < len? lo + KP_CHUNK_SIZE : len;
+				p->n = 0, p->a = 0;
+			}
+		}
+		g.c_st[g.b->n] = g.n_chunks;
+		kp_process(&g);
 	}
-	rld_destroy(e);
 	kseq_destroy(ks);
-	gzclose(fp);
-	return 0;
+
+	fm_batch_destroy(g.b); free(g.out); free(g.c_st);
+	free(g.chunk); free(g.c2s);
+	rld_destroy((rld_t*)g.e);
+	return fm_gzclose(fp) < 0? 1 : 0;
 }
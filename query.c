@@ -0,0 +1,148 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "fermi2.h"
+#include "kstring.h"
+#include "ketopt.h"
+#include "seqio.h"
+
+extern int ks_getuntil2(kstream_t *ks, int delimiter, kstring_t *str, int *dret, int append);
+extern void kt_for(int n_threads, void (*func)(void*,long,int), void *data, long n);
+
+int fm_query(const rld_t *e, int len, const char *s, rldintv_t *ik, rldintv_t ok[6])
+{ // find the longest suffix of s in e; on return, ok[] keeps the backward extensions of ik
+	extern unsigned char seq_nt6_table[128];
+	int i;
+	ik->x[0] = ik->x[1] = 0, ik->x[2] = e->mcnt[0], ik->info = 0;
+	rld_extend(e, ik, ok, 1);
+	for (i = len - 1; i >= 0; --i) {
+		int c = (uint8_t)s[i];
+		c = c < 6? c : c < 128? seq_nt6_table[c] : 5;
+		if (ok[c].x[2] == 0) break;
+		*ik = ok[c];
+		rld_extend(e, ik, ok, 1);
+	}
+	return len - 1 - i;
+}
+
+typedef struct {
+	const rld_t *e;
+	int n_threads;
+	int n_seqs, m_seqs;
+	char **seq, **out;
+} qglobal_t;
+
+static void query_worker(void *data, long jid, int tid)
+{
+	qglobal_t *g = (qglobal_t*)data;
+	char *seq = g->seq[jid];
+	int c, len, l;
+	rldintv_t ik, ok[6];
+	kstring_t str = {0,0,0};
+
+	len = strlen(seq);
+	l = fm_query(g->e, len, seq, &ik, ok);
+	kputw(len, &str); kputc('\t', &str);
+	kputw(l, &str); kputc('\t', &str);
+	for (c = 1; c <= 4; ++c) {
+		if (c != 1) kputc(':', &str);
+		kputl(ok[c].x[2], &str);
+	}
+	kputc('\t', &str); kputs(seq, &str); kputc('\t', &str);
+	rld_extend(g->e, &ik, ok, 0);
+	for (c = 4; c >= 1; --c) {
+		if (c != 4) kputc(':', &str);
+		kputl(ok[c].x[2], &str);
+	}
+	free(seq);
+	g->out[jid] = str.s;
+}
+
+static void query_process(qglobal_t *g)
+{
+	int i;
+	kt_for(g->n_threads, query_worker, g, g->n_seqs);
+	for (i = 0; i < g->n_seqs; ++i) {
+		puts(g->out[i]);
+		free(g->out[i]);
+	}
+	g->n_seqs = 0;
+}
+
+int main_query(int argc, char *argv[])
+{
+	ketopt_t o = KETOPT_INIT;
+	int c, use_mmap = 0, is_seq, batch_size = 10000000, l_seqs;
+	qglobal_t g;
+	kseq_t *ks;
+	kstring_t str = {0,0,0};
+	fm_gzf_t *fp;
+
+	memset(&g, 0, sizeof(qglobal_t));
+	g.n_threads = 1;
+	while ((c = ketopt(&o, argc, argv, 1, "t:b:M", 0)) >= 0) {
+		if (c == 't') g.n_threads = atoi(o.arg);
+		else if (c == 'b') batch_size = atoi(o.arg);
+		else if (c == 'M') use_mmap = 1;
+	}
+	if (argc - o.ind < 1) {
+		fprintf(stderr, "Usage: fermi2 query [options] <index.fmd> [queries.txt|in.fa]\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -t INT    number of threads [%d]\n", g.n_threads);
+		fprintf(stderr, "  -b INT    batch size [%d]\n", batch_size);
+		fprintf(stderr, "  -M        load the index with mmap\n");
+		fprintf(stderr, "Input: one sequence per line, or FASTA/FASTQ\n");
+		fprintf(stderr, "Output: queryLen  matchedSuffixLen  backwardA:C:G:T  query  forwardA:C:G:T\n");
+		return 1;
+	}
+
+	fp = fm_gzopen(o.ind + 1 < argc? argv[o.ind+1] : "-", g.n_threads);
+	if (fp == 0) {
+		fprintf(stderr, "[E::%s] failed to open the query file\n", __func__);
+		return 1;
+	}
+	g.e = use_mmap? rld_restore_mmap(argv[o.ind]) : rld_restore(argv[o.ind]);
+	if (g.e == 0) {
+		fprintf(stderr, "[E::%s] failed to open the index file\n", __func__);
+		fm_gzclose(fp);
+		return 1;
+	}
+	if (g.e->mcnt[2] != g.e->mcnt[5] || g.e->mcnt[3] != g.e->mcnt[4])
+		fprintf(stderr, "[W::%s] the index does not include both strands; forward counts are meaningless\n", __func__);
+
+	c = fm_gzgetc(fp); // peek the first character to choose between line and FASTA/Q input
+	if (c >= 0) fm_gzungetc(c, fp);
+	is_seq = (c == '>' || c == '@');
+	batch_size *= g.n_threads;
+	ks = kseq_init(fp);
+	l_seqs = 0;
+	while (1) {
+		int dret, l;
+		char *s;
+		if (is_seq) {
+			if (kseq_read(ks) < 0) break;
+			s = ks->seq.s, l = ks->seq.l;
+		} else {
+			if (ks_getuntil2(ks->f, KS_SEP_LINE, &str, &dret, 0) < 0) break;
+			if (str.l == 0) continue;
+			s = str.s, l = str.l;
+		}
+		if (g.n_seqs == g.m_seqs) {
+			g.m_seqs = g.m_seqs? g.m_seqs<<1 : 4;
+			g.seq = realloc(g.seq, g.m_seqs * sizeof(char*));
+			g.out = realloc(g.out, g.m_seqs * sizeof(char*));
+		}
+		g.seq[g.n_seqs++] = strdup(s); // free'd in query_worker()
+		l_seqs += l;
+		if (l_seqs >= batch_size) {
+			query_process(&g);
+			l_seqs = 0;
+		}
+	}
+	query_process(&g); // the last batch
+	kseq_destroy(ks);
+
+	free(str.s); free(g.seq); free(g.out);
+	rld_destroy((rld_t*)g.e);
+	return fm_gzclose(fp) < 0? 1 : 0;
+}
@@ -470,6 +470,21 @@ void rld_rank2a(const rld_t *e, uint64_t k, uint64_t l, uint64_t *ok, uint64_t *
 	}
 }
 
+void rld_prefetch(const rld_t *e, int n, const uint64_t *k)
+{ // prefetch what rld_rank*() reads for k[0..n-1]: frame entries first, and then the blocks they point to
+	int i;
+	for (i = 0; i < n; ++i)
+		if (k[i] > 0) __builtin_prefetch(e->frame + ((k[i] - 1) >> e->ibits) * e->asize1);
+	for (i = 0; i < n; ++i) {
+		const uint64_t *z, *q;
+		if (k[i] == 0) continue;
+		z = e->frame + ((k[i] - 1) >> e->ibits) * e->asize1;
+		q = e->z[*z>>RLD_LBITS] + (*z&RLD_LMASK);
+		__builtin_prefetch(q);
+		__builtin_prefetch(q + e->ssize); // rld_locate_blk() always reads the next small block
+	}
+}
+
 int rld_extend(const rld_t *e, const rldintv_t *ik, rldintv_t ok[6], int is_back)
 { // TODO: this can be accelerated a little by using rld_rank1a() when ik.x[2]==1
 	uint64_t tk[6], tl[6];
@@ -63,6 +63,7 @@ extern "C" {
 	int rld_rank1a(const rld_t *e, uint64_t k, uint64_t *ok);
 	void rld_rank21(const rld_t *e, uint64_t k, uint64_t l, int c, uint64_t *ok, uint64_t *ol);
 	void rld_rank2a(const rld_t *e, uint64_t k, uint64_t l, uint64_t *ok, uint64_t *ol);
+	void rld_prefetch(const rld_t *e, int n, const uint64_t *k);
 
 	int rld_extend(const rld_t *e, const rldintv_t *ik, rldintv_t ok[6], int is_back);
 
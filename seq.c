@@ -1,12 +1,10 @@
-#include <zlib.h>
 #include <math.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <unistd.h>
 #include <assert.h>
 #include "kstring.h"
-#include "kseq.h"
-KSEQ_INIT2(, gzFile, gzread)
+#include "seqio.h"
 
 unsigned char seq_nt6_table[128] = {
     0, 5, 5, 5,  5, 5, 5, 5,  5, 5, 5, 5,  5, 5, 5, 5,
@@ -54,51 +52,65 @@ void seq_revcomp6(int l, unsigned char *s)
 	if (l&1) s[i] = (s[i] >= 1 && s[i] <= 4)? 5 - s[i] : s[i];
 }
 
-static void write_seq(const kseq_t *seq, kstring_t *out)
+static void write_seq(const fm_batch_t *b, int i, const char *name, kstring_t *out)
 {
-	kputc(seq->qual.l? '@' : '>', out);
-	kputsn(seq->name.s, seq->name.l, out);
-	if (seq->comment.l) {
+	kputc(b->qual[i]? '@' : '>', out);
+	kputs(name, out);
+	if (b->comment[i]) {
 		kputc(' ', out);
-		kputsn(seq->comment.s, seq->comment.l, out);
+		kputs(b->comment[i], out);
 	}
 	kputc('\n', out);
-	kputsn(seq->seq.s, seq->seq.l, out);
-	if (seq->qual.l) {
+	kputsn(b->seq[i], b->len[i], out);
+	if (b->qual[i]) {
 		kputsn("\n+\n", 3, out);
-		kputsn(seq->qual.s, seq->qual.l, out);
+		kputsn(b->qual[i], b->len[i], out);
 	}
 	kputc('\n', out);
 }
 
 int main_interleave(int argc, char *argv[])
 {
-	gzFile fp1, fp2;
+	fm_gzf_t *fp1, *fp2;
 	kseq_t *seq[2];
+	fm_batch_t *b[2];
 	kstring_t str;
+	int i, n;
 
 	if (argc < 3) {
 		fprintf(stderr, "Usage: fermi interleave <in1.fq> <in2.fq>\n");
 		return 1;
 	}
 	str.l = str.m = 0; str.s = 0;
-	fp1 = strcmp(argv[1], "-")? gzopen(argv[1], "r") : gzdopen(fileno(stdin), "r");
-	fp2 = strcmp(argv[2], "-")? gzopen(argv[2], "r") : gzdopen(fileno(stdin), "r");
+	fp1 = fm_gzopen(argv[1], 1);
+	fp2 = fm_gzopen(argv[2], 1);
+	if (fp1 == 0 || fp2 == 0) {
+		fprintf(stderr, "[E::%s] failed to open the input files\n", __func__);
+		fm_gzclose(fp1); fm_gzclose(fp2);
+		return 1;
+	}
 	seq[0] = kseq_init(fp1);
 	seq[1] = kseq_init(fp2);
-	while (kseq_read(seq[0]) >= 0) {
-		if (kseq_read(seq[1]) < 0) break; // one file ends
+	b[0] = fm_batch_init();
+	b[1] = fm_batch_init();
+	while (fm_batch_read(seq[0], 1<<24, 0, b[0]) > 0) {
+		n = fm_batch_read(seq[1], INT64_MAX, b[0]->n, b[1]); // the same number of reads from the other end
 		str.l = 0;
-		if (seq[0]->name.l > 2 && seq[0]->name.s[seq[0]->name.l-2] == '/' && isdigit(seq[0]->name.s[seq[0]->name.l-1]))
-			seq[0]->name.s[(seq[0]->name.l -= 2)] = 0; // trim tailing "/[0-9]$"
-		seq[1]->name.l = 0;
-		kputsn(seq[0]->name.s, seq[0]->name.l, &seq[1]->name); // make sure two ends having the same name
-		write_seq(seq[0], &str);
-		write_seq(seq[1], &str);
-		fputs(str.s, stdout);
+		for (i = 0; i < n; ++i) {
+			char *name = b[0]->name[i];
+			int l = strlen(name);
+			if (l > 2 && name[l-2] == '/' && isdigit(name[l-1]))
+				name[l-2] = 0; // trim tailing "/[0-9]$"
+			write_seq(b[0], i, name, &str); // make sure two ends having the same name
+			write_seq(b[1], i, name, &str);
+		}
+		fwrite(str.s, 1, str.l, stdout);
+		if (n < b[0]->n) break; // one file ends
 	}
-	kseq_destroy(seq[0]); gzclose(fp1);
-	kseq_destroy(seq[1]); gzclose(fp2);
+	fm_batch_destroy(b[0]); fm_batch_destroy(b[1]);
+	kseq_destroy(seq[0]); kseq_destroy(seq[1]);
+	n = fm_gzclose(fp1) < 0? 1 : 0;
+	if (fm_gzclose(fp2) < 0) n = 1;
 	free(str.s);
-	return 0;
+	return n;
 }
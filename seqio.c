@@ -0,0 +1,540 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+#define FM_SEQIO_KSEQ_IMPL
+#include "seqio.h"
+
+/*******************
+ *** Input files ***
+ *******************/
+
+#define FM_GZ_IBUF    0x20000 // input buffer; must hold a full BGZF block
+#define FM_BGZF_MAX   0x10000 // max size of a BGZF block, compressed or not
+#define FM_BGZF_PER_T 16      // BGZF blocks per thread per batch
+#define FM_BGZF_BATCH 256     // max BGZF blocks per batch
+
+#define FM_GZ_PLAIN 0
+#define FM_GZ_GZIP  1
+#define FM_GZ_BGZF  2
+
+typedef struct {
+	int l_in, l_out;
+	uint8_t *in, *out; // in: the full compressed block; out: inflated data
+} bgzf_blk_t;
+
+typedef struct { // a batch of BGZF blocks, inflated together with kt_for()
+	int n, err, gz; // gz: an ordinary gzip member follows the blocks
+	bgzf_blk_t *a;
+	uint8_t *mem;
+} bgzf_batch_t;
+
+struct fm_gzf_s {
+	int fd, mode, raw_eof, is_eof, err, pushback;
+	int i_beg, i_end;
+	uint8_t *ibuf;
+	z_stream zs;
+	// BGZF; the helper thread reads and inflates batches into q[], which the caller consumes in order
+	int n_threads, m_blk, stop;
+	int q_beg, q_n, blk, off;
+	bgzf_batch_t q[2];
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cv;
+};
+
+extern void kt_for(int n_threads, void (*func)(void*,long,int), void *data, long n);
+
+static int gzf_need(fm_gzf_t *f, int n) // make sure n bytes are buffered; return the number of buffered bytes
+{
+	if (f->i_end - f->i_beg >= n) return f->i_end - f->i_beg;
+	memmove(f->ibuf, f->ibuf + f->i_beg, f->i_end - f->i_beg);
+	f->i_end -= f->i_beg, f->i_beg = 0;
+	while (f->i_end < n && !f->raw_eof) {
+		ssize_t r = read(f->fd, f->ibuf + f->i_end, FM_GZ_IBUF - f->i_end);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) f->raw_eof = 1;
+		else f->i_end += r;
+	}
+	return f->i_end;
+}
+
+static int gzf_bgzf_size(fm_gzf_t *f) // size of the BGZF block at the front of the buffer; 0 if not BGZF
+{
+	const uint8_t *p;
+	int i, xlen;
+	if (gzf_need(f, 12) < 12) return 0;
+	p = f->ibuf + f->i_beg;
+	if (p[0] != 31 || p[1] != 139 || p[2] != 8 || !(p[3]&4)) return 0;
+	xlen = p[10] | p[11]<<8;
+	if (gzf_need(f, 12 + xlen) < 12 + xlen) return 0;
+	p = f->ibuf + f->i_beg;
+	for (i = 12; i + 4 <= 12 + xlen; i += 4 + (p[i+2] | p[i+3]<<8))
+		if (p[i] == 'B' && p[i+1] == 'C' && (p[i+2] | p[i+3]<<8) == 2 && i + 6 <= 12 + xlen)
+			return (p[i+4] | p[i+5]<<8) + 1;
+	return 0;
+}
+
+static inline uint32_t gzf_le32(const uint8_t *p) { return p[0] | p[1]<<8 | p[2]<<16 | (uint32_t)p[3]<<24; }
+
+static void bgzf_inflate_worker(void *data, long i, int tid)
+{
+	bgzf_batch_t *b = (bgzf_batch_t*)data;
+	bgzf_blk_t *p = &b->a[i];
+	int xlen = p->in[10] | p->in[11]<<8;
+	uint32_t crc = gzf_le32(p->in + p->l_in - 8), isize = gzf_le32(p->in + p->l_in - 4);
+	z_stream zs;
+
+	memset(&zs, 0, sizeof(z_stream));
+	p->l_out = -1; // failed
+	if (isize > FM_BGZF_MAX || p->l_in < 20 + xlen || inflateInit2(&zs, -15) != Z_OK) return;
+	zs.next_in = p->in + 12 + xlen, zs.avail_in = p->l_in - 20 - xlen;
+	zs.next_out = p->out, zs.avail_out = FM_BGZF_MAX;
+	if (inflate(&zs, Z_FINISH) == Z_STREAM_END && zs.total_out == isize && crc32(crc32(0L, Z_NULL, 0), p->out, isize) == crc)
+		p->l_out = isize;
+	inflateEnd(&zs);
+}
+
+static void *bgzf_helper(void *data)
+{
+	fm_gzf_t *f = (fm_gzf_t*)data;
+	for (;;) {
+		bgzf_batch_t *b;
+		int i, size, l_in = 0, stop;
+		pthread_mutex_lock(&f->lock);
+		while (f->q_n == 2 && !f->stop)
+			pthread_cond_wait(&f->cv, &f->lock);
+		stop = f->stop;
+		b = &f->q[(f->q_beg + f->q_n) & 1]; // the consumer never touches this slot until q_n is increased
+		pthread_mutex_unlock(&f->lock);
+		if (stop) break;
+		for (b->n = b->err = b->gz = 0; b->n < f->m_blk; ++b->n) {
+			bgzf_blk_t *p = &b->a[b->n];
+			if ((size = gzf_bgzf_size(f)) == 0) { // end of file, another gzip member or trailing garbage
+				if (gzf_need(f, 2) >= 2 && f->ibuf[f->i_beg] == 31 && f->ibuf[f->i_beg+1] == 139) b->gz = 1;
+				break; // trailing garbage is ignored, as gzread() does
+			}
+			if (gzf_need(f, size) < size) { // truncated
+				b->err = 1;
+				break;
+			}
+			p->in = b->mem + l_in, p->l_in = size;
+			p->out = b->mem + (size_t)f->m_blk * FM_BGZF_MAX + (size_t)b->n * FM_BGZF_MAX;
+			memcpy(p->in, f->ibuf + f->i_beg, size);
+			f->i_beg += size, l_in += size;
+		}
+		kt_for(f->n_threads, bgzf_inflate_worker, b, b->n);
+		for (i = 0; i < b->n; ++i) // deliver nothing from the first bad block on
+			if (b->a[i].l_out < 0) {
+				b->n = i, b->err = 1;
+				break;
+			}
+		pthread_mutex_lock(&f->lock);
+		++f->q_n;
+		pthread_cond_broadcast(&f->cv);
+		pthread_mutex_unlock(&f->lock);
+		if (b->n == 0 || b->err || b->gz) break; // end of file, error, or the caller takes over the input
+	}
+	return 0;
+}
+
+fm_gzf_t *fm_gzopen(const char *fn, int n_threads)
+{
+	fm_gzf_t *f;
+	int fd, i;
+	fd = strcmp(fn, "-")? open(fn, O_RDONLY) : fileno(stdin);
+	if (fd < 0) return 0;
+	f = (fm_gzf_t*)calloc(1, sizeof(fm_gzf_t));
+	f->fd = fd, f->pushback = -1;
+	f->ibuf = (uint8_t*)malloc(FM_GZ_IBUF);
+	f->n_threads = n_threads > 1? n_threads : 1;
+	if (gzf_bgzf_size(f) > 0) {
+		f->mode = FM_GZ_BGZF;
+		f->m_blk = f->n_threads * FM_BGZF_PER_T < FM_BGZF_BATCH? f->n_threads * FM_BGZF_PER_T : FM_BGZF_BATCH;
+		for (i = 0; i < 2; ++i) {
+			f->q[i].a = (bgzf_blk_t*)calloc(f->m_blk, sizeof(bgzf_blk_t));
+			f->q[i].mem = (uint8_t*)malloc((size_t)f->m_blk * FM_BGZF_MAX * 2);
+		}
+		pthread_mutex_init(&f->lock, 0);
+		pthread_cond_init(&f->cv, 0);
+		pthread_create(&f->tid, 0, bgzf_helper, f);
+	} else if (f->i_end - f->i_beg >= 2 && f->ibuf[f->i_beg] == 31 && f->ibuf[f->i_beg+1] == 139) {
+		f->mode = FM_GZ_GZIP;
+		if (inflateInit2(&f->zs, 15 + 16) != Z_OK) {
+			fm_gzclose(f);
+			return 0;
+		}
+	} else f->mode = FM_GZ_PLAIN;
+	return f;
+}
+
+static int gzf_read_gzip(fm_gzf_t *f, uint8_t *buf, unsigned len)
+{
+	f->zs.next_out = buf, f->zs.avail_out = len;
+	while (f->zs.avail_out > 0 && !f->is_eof) {
+		int ret;
+		if (gzf_need(f, 1) == 0) { // truncated
+			f->err = 1, f->is_eof = 1;
+			break;
+		}
+		f->zs.next_in = f->ibuf + f->i_beg, f->zs.avail_in = f->i_end - f->i_beg;
+		ret = inflate(&f->zs, Z_NO_FLUSH);
+		f->i_beg = f->i_end - f->zs.avail_in;
+		if (ret == Z_STREAM_END) { // the end of a member; there may be more
+			if (gzf_need(f, 2) >= 2 && f->ibuf[f->i_beg] == 31 && f->ibuf[f->i_beg+1] == 139) inflateReset(&f->zs);
+			else f->is_eof = 1; // trailing garbage is ignored, as gzread() does
+		} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			f->err = 1, f->is_eof = 1;
+		}
+	}
+	return len - f->zs.avail_out;
+}
+
+static int gzf_read_bgzf(fm_gzf_t *f, uint8_t *buf, unsigned len)
+{
+	unsigned l = 0;
+	while (l < len && !f->is_eof) {
+		bgzf_batch_t *b;
+		bgzf_blk_t *p;
+		pthread_mutex_lock(&f->lock);
+		while (f->q_n == 0)
+			pthread_cond_wait(&f->cv, &f->lock);
+		pthread_mutex_unlock(&f->lock);
+		b = &f->q[f->q_beg];
+		if (f->blk == b->n) { // this batch has been consumed
+			if (b->gz && !b->err) { // the helper has stopped; inflate the remaining members in this thread
+				if (inflateInit2(&f->zs, 15 + 16) != Z_OK) {
+					f->is_eof = f->err = 1;
+					break;
+				}
+				f->mode = FM_GZ_GZIP;
+				return l + gzf_read_gzip(f, buf + l, len - l);
+			}
+			if (b->n == 0 || b->err) {
+				f->is_eof = 1, f->err = b->err;
+				break;
+			}
+			pthread_mutex_lock(&f->lock);
+			f->q_beg ^= 1, --f->q_n;
+			pthread_cond_broadcast(&f->cv);
+			pthread_mutex_unlock(&f->lock);
+			f->blk = f->off = 0;
+			continue;
+		}
+		p = &b->a[f->blk];
+		if (p->l_out - f->off <= len - l) {
+			memcpy(buf + l, p->out + f->off, p->l_out - f->off);
+			l += p->l_out - f->off;
+			++f->blk, f->off = 0;
+		} else {
+			memcpy(buf + l, p->out + f->off, len - l);
+			f->off += len - l, l = len;
+		}
+	}
+	return l;
+}
+
+int fm_gzread(fm_gzf_t *f, void *_buf, unsigned len)
+{
+	uint8_t *buf = (uint8_t*)_buf;
+	int l = 0;
+	if (len == 0) return 0;
+	if (f->pushback >= 0) {
+		buf[l++] = f->pushback, f->pushback = -1;
+		--len;
+	}
+	if (f->mode == FM_GZ_BGZF) {
+		l += gzf_read_bgzf(f, buf + l, len);
+	} else if (f->mode == FM_GZ_GZIP) {
+		l += gzf_read_gzip(f, buf + l, len);
+	} else {
+		unsigned n;
+		while (len > 0 && (n = gzf_need(f, 1)) > 0) { // kseq takes a short read as the end of file
+			n = n < len? n : len;
+			memcpy(buf + l, f->ibuf + f->i_beg, n);
+			f->i_beg += n, l += n, len -= n;
+		}
+	}
+	if (f->err == 1) { // report once; the data ends here
+		fprintf(stderr, "[E::%s] truncated or corrupted gzip input\n", __func__);
+		f->err = 2;
+	}
+	return l;
+}
+
+int fm_gzgetc(fm_gzf_t *f)
+{
+	unsigned char c;
+	return fm_gzread(f, &c, 1) == 1? c : -1;
+}
+
+int fm_gzungetc(int c, fm_gzf_t *f)
+{
+	if (c < 0 || f->pushback >= 0) return -1;
+	return (f->pushback = c);
+}
+
+int fm_gzclose(fm_gzf_t *f)
+{
+	int i, ret;
+	if (f == 0) return -1;
+	ret = f->err? -1 : 0;
+	if (f->m_blk > 0) { // BGZF, possibly switched to FM_GZ_GZIP
+		pthread_mutex_lock(&f->lock);
+		f->stop = 1;
+		pthread_cond_broadcast(&f->cv);
+		pthread_mutex_unlock(&f->lock);
+		pthread_join(f->tid, 0);
+		pthread_mutex_destroy(&f->lock);
+		pthread_cond_destroy(&f->cv);
+		for (i = 0; i < 2; ++i) free(f->q[i].a), free(f->q[i].mem);
+	} else if (f->mode == FM_GZ_GZIP) inflateEnd(&f->zs);
+	if (f->fd != fileno(stdin)) close(f->fd);
+	free(f->ibuf); free(f);
+	return ret;
+}
+
+/********************
+ *** Output files ***
+ ********************/
+
+#define FM_BGZF_IN 0xff00 // input bytes per BGZF block; stored blocks still fit FM_BGZF_MAX
+#define FM_BGZF_LEVEL 1   // like "gzip -1" in our pipelines
+
+typedef struct {
+	int n, *l_in, *l_out; // the last block may be partial
+	uint8_t *in, *out; // n blocks of FM_BGZF_IN and FM_BGZF_MAX bytes
+	int err;
+} bgzw_batch_t;
+
+struct fm_gzw_s {
+	FILE *fp;
+	int is_bgzf, n_threads, m_blk, err;
+	int cur, pending, stop; // the caller fills q[cur]; the helper processes q[pending] if pending >= 0
+	bgzw_batch_t q[2];
+	pthread_t tid;
+	pthread_mutex_t lock, wlock; // wlock serializes callers of fm_gzwrite()
+	pthread_cond_t cv;
+};
+
+static const uint8_t bgzf_eof[28] = "\037\213\010\4\0\0\0\0\0\377\6\0\102\103\2\0\033\0\3\0\0\0\0\0\0\0\0\0";
+
+static int bgzf_deflate1(int level, const uint8_t *in, int l_in, uint8_t *out)
+{ // compress one block into out; return the block size, or 0 if it doesn't fit
+	z_stream zs;
+	uint32_t crc;
+	int ret;
+	memset(&zs, 0, sizeof(z_stream));
+	if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return 0;
+	zs.next_in = (uint8_t*)in, zs.avail_in = l_in;
+	zs.next_out = out + 18, zs.avail_out = FM_BGZF_MAX - 26;
+	ret = deflate(&zs, Z_FINISH);
+	deflateEnd(&zs);
+	if (ret != Z_STREAM_END) return 0;
+	memcpy(out, bgzf_eof, 18); // the header is the same except BSIZE
+	out[16] = (zs.total_out + 25) & 0xff, out[17] = (zs.total_out + 25) >> 8;
+	crc = crc32(crc32(0L, Z_NULL, 0), in, l_in);
+	out += 18 + zs.total_out;
+	out[0] = crc, out[1] = crc>>8, out[2] = crc>>16, out[3] = crc>>24;
+	out[4] = l_in, out[5] = l_in>>8, out[6] = l_in>>16, out[7] = l_in>>24;
+	return zs.total_out + 26;
+}
+
+static void bgzf_deflate_worker(void *data, long i, int tid)
+{
+	bgzw_batch_t *b = (bgzw_batch_t*)data;
+	uint8_t *in = b->in + i * FM_BGZF_IN, *out = b->out + i * FM_BGZF_MAX;
+	if ((b->l_out[i] = bgzf_deflate1(FM_BGZF_LEVEL, in, b->l_in[i], out)) == 0) // incompressible; store
+		if ((b->l_out[i] = bgzf_deflate1(0, in, b->l_in[i], out)) == 0) b->err = 1;
+}
+
+static void *bgzw_helper(void *data)
+{
+	fm_gzw_t *w = (fm_gzw_t*)data;
+	for (;;) {
+		bgzw_batch_t *b;
+		int i;
+		pthread_mutex_lock(&w->lock);
+		while (w->pending < 0 && !w->stop)
+			pthread_cond_wait(&w->cv, &w->lock);
+		if (w->pending < 0) { // stopped and nothing left
+			pthread_mutex_unlock(&w->lock);
+			break;
+		}
+		b = &w->q[w->pending];
+		pthread_mutex_unlock(&w->lock);
+		kt_for(w->n_threads, bgzf_deflate_worker, b, b->n);
+		for (i = 0; i < b->n && !b->err; ++i)
+			if (fwrite(b->out + (size_t)i * FM_BGZF_MAX, 1, b->l_out[i], w->fp) != b->l_out[i]) b->err = 1;
+		pthread_mutex_lock(&w->lock);
+		if (b->err) w->err = 1;
+		b->n = 0, b->l_in[0] = 0, b->err = 0;
+		w->pending = -1;
+		pthread_cond_broadcast(&w->cv);
+		pthread_mutex_unlock(&w->lock);
+	}
+	return 0;
+}
+
+static void bgzw_submit(fm_gzw_t *w) // hand q[cur] over to the helper and switch to the other slot
+{
+	bgzw_batch_t *b = &w->q[w->cur];
+	if (b->n < w->m_blk && b->l_in[b->n] > 0) ++b->n; // the partial last block
+	if (b->n == 0) return;
+	pthread_mutex_lock(&w->lock);
+	while (w->pending >= 0)
+		pthread_cond_wait(&w->cv, &w->lock);
+	w->pending = w->cur;
+	pthread_cond_broadcast(&w->cv);
+	pthread_mutex_unlock(&w->lock);
+	w->cur ^= 1; // the helper has finished this slot, as pending was cleared
+}
+
+fm_gzw_t *fm_gzwopen(const char *fn, int n_threads)
+{
+	fm_gzw_t *w;
+	int i;
+	w = (fm_gzw_t*)calloc(1, sizeof(fm_gzw_t));
+	pthread_mutex_init(&w->wlock, 0);
+	if (fn == 0) {
+		w->fp = stdout;
+		return w;
+	}
+	if ((w->fp = strcmp(fn, "-")? fopen(fn, "wb") : stdout) == 0) {
+		pthread_mutex_destroy(&w->wlock);
+		free(w);
+		return 0;
+	}
+	w->is_bgzf = 1, w->pending = -1;
+	w->n_threads = n_threads > 1? n_threads : 1;
+	w->m_blk = w->n_threads * FM_BGZF_PER_T < FM_BGZF_BATCH? w->n_threads * FM_BGZF_PER_T : FM_BGZF_BATCH;
+	for (i = 0; i < 2; ++i) {
+		bgzw_batch_t *b = &w->q[i];
+		b->l_in  = (int*)calloc(w->m_blk, sizeof(int));
+		b->l_out = (int*)calloc(w->m_blk, sizeof(int));
+		b->in  = (uint8_t*)malloc((size_t)w->m_blk * FM_BGZF_IN);
+		b->out = (uint8_t*)malloc((size_t)w->m_blk * FM_BGZF_MAX);
+	}
+	pthread_mutex_init(&w->lock, 0);
+	pthread_cond_init(&w->cv, 0);
+	pthread_create(&w->tid, 0, bgzw_helper, w);
+	return w;
+}
+
+int fm_gzwrite(fm_gzw_t *w, const void *_buf, size_t len)
+{
+	const uint8_t *buf = (const uint8_t*)_buf;
+	int ret = len;
+	pthread_mutex_lock(&w->wlock);
+	if (!w->is_bgzf) {
+		if (fwrite(buf, 1, len, w->fp) != len) ret = -1;
+	} else {
+		while (len > 0) {
+			bgzw_batch_t *b = &w->q[w->cur];
+			int n = FM_BGZF_IN - b->l_in[b->n];
+			n = len < n? len : n;
+			memcpy(b->in + (size_t)b->n * FM_BGZF_IN + b->l_in[b->n], buf, n);
+			b->l_in[b->n] += n, buf += n, len -= n;
+			if (b->l_in[b->n] == FM_BGZF_IN) { // the block is full
+				if (++b->n == w->m_blk) bgzw_submit(w);
+				else b->l_in[b->n] = 0;
+			}
+		}
+	}
+	pthread_mutex_unlock(&w->wlock);
+	return ret;
+}
+
+int fm_gzwclose(fm_gzw_t *w)
+{
+	int i, err = 0;
+	if (w == 0) return -1;
+	if (w->is_bgzf) {
+		bgzw_submit(w);
+		pthread_mutex_lock(&w->lock);
+		w->stop = 1;
+		pthread_cond_broadcast(&w->cv);
+		pthread_mutex_unlock(&w->lock);
+		pthread_join(w->tid, 0);
+		if (fwrite(bgzf_eof, 1, 28, w->fp) != 28) w->err = 1;
+		pthread_mutex_destroy(&w->lock);
+		pthread_cond_destroy(&w->cv);
+		for (i = 0; i < 2; ++i) {
+			free(w->q[i].l_in); free(w->q[i].l_out);
+			free(w->q[i].in); free(w->q[i].out);
+		}
+	}
+	if (fflush(w->fp) != 0) w->err = 1;
+	if (w->fp != stdout && fclose(w->fp) != 0) w->err = 1;
+	err = w->err;
+	pthread_mutex_destroy(&w->wlock);
+	free(w);
+	if (err) fprintf(stderr, "[E::%s] failed to write the output\n", __func__);
+	return err? -1 : 0;
+}
+
+/*******************
+ *** Read batch ***
+ *******************/
+
+fm_batch_t *fm_batch_init(void)
+{
+	return (fm_batch_t*)calloc(1, sizeof(fm_batch_t));
+}
+
+void fm_batch_destroy(fm_batch_t *b)
+{
+	if (b == 0) return;
+	free(b->len); free(b->name); free(b->comment); free(b->seq); free(b->qual);
+	free(b->buf); free(b);
+}
+
+static inline uint64_t fm_batch_push(fm_batch_t *b, const kstring_t *s)
+{ // append s to the arena; return its offset
+	uint64_t off = b->l_buf;
+	if (b->l_buf + s->l + 1 > b->m_buf) {
+		b->m_buf = b->l_buf + s->l + 1;
+		b->m_buf += b->m_buf>>1;
+		b->buf = (char*)realloc(b->buf, b->m_buf);
+	}
+	memcpy(b->buf + b->l_buf, s->s, s->l);
+	b->buf[b->l_buf + s->l] = 0;
+	b->l_buf += s->l + 1;
+	return off;
+}
+
+int fm_batch_read(kseq_t *ks, int64_t max_len, int max_n, fm_batch_t *b)
+{
+	int64_t l = 0;
+	int i;
+	b->n = 0, b->l_buf = 0;
+	while (l < max_len && (max_n <= 0 || b->n < max_n) && kseq_read(ks) >= 0) {
+		if (b->n == b->m) {
+			b->m = b->m? b->m<<1 : 256;
+			b->len     = (int*)  realloc(b->len,     b->m * sizeof(int));
+			b->name    = (char**)realloc(b->name,    b->m * sizeof(char*));
+			b->comment = (char**)realloc(b->comment, b->m * sizeof(char*));
+			b->seq     = (char**)realloc(b->seq,     b->m * sizeof(char*));
+			b->qual    = (char**)realloc(b->qual,    b->m * sizeof(char*));
+		}
+		// keep offsets until the arena stops moving
+		b->len[b->n] = ks->seq.l;
+		b->name[b->n]    = (char*)(intptr_t)fm_batch_push(b, &ks->name);
+		b->comment[b->n] = ks->comment.l? (char*)(intptr_t)fm_batch_push(b, &ks->comment) : (char*)(intptr_t)-1;
+		b->seq[b->n]     = (char*)(intptr_t)fm_batch_push(b, &ks->seq);
+		b->qual[b->n]    = ks->qual.l? (char*)(intptr_t)fm_batch_push(b, &ks->qual) : (char*)(intptr_t)-1;
+		l += ks->seq.l;
+		++b->n;
+	}
+	for (i = 0; i < b->n; ++i) {
+		b->name[i] = b->buf + (intptr_t)b->name[i];
+		b->seq[i]  = b->buf + (intptr_t)b->seq[i];
+		b->comment[i] = (intptr_t)b->comment[i] < 0? 0 : b->buf + (intptr_t)b->comment[i];
+		b->qual[i]    = (intptr_t)b->qual[i]    < 0? 0 : b->buf + (intptr_t)b->qual[i];
+	}
+	return b->n;
+}
@@ -0,0 +1,116 @@
+#ifndef FM_SEQIO_H
+#define FM_SEQIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*******************
+ *** Input files ***
+ *******************/
+
+typedef struct fm_gzf_s fm_gzf_t; // plain, gzip or BGZF input; BGZF blocks are inflated in parallel
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Open a plain or gzip'd file for reading
+ *
+ * If the file is BGZF, blocks are inflated by n_threads threads on a
+ * helper thread, ahead of the reader. Other gzip files, including
+ * multi-member ones, are inflated in the calling thread, and so is the rest
+ * of a BGZF file from the first member that is not BGZF. Bytes after the
+ * last member are ignored unless they start with the gzip magic.
+ *
+ * @param fn         file name; "-" for stdin
+ * @param n_threads  number of threads for inflating BGZF blocks
+ *
+ * @return file handler, or NULL if the file can't be opened
+ */
+fm_gzf_t *fm_gzopen(const char *fn, int n_threads);
+int fm_gzread(fm_gzf_t *f, void *buf, unsigned len);
+int fm_gzgetc(fm_gzf_t *f);
+int fm_gzungetc(int c, fm_gzf_t *f); // only one character can be pushed back
+int fm_gzclose(fm_gzf_t *f); // return -1 if the input was truncated or corrupted
+
+#ifdef __cplusplus
+}
+#endif
+
+/********************
+ *** Output files ***
+ ********************/
+
+typedef struct fm_gzw_s fm_gzw_t; // plain stdout or a BGZF file compressed in parallel
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Open an output file
+ *
+ * Data are cut into BGZF blocks. A helper thread compresses the blocks
+ * with n_threads threads and writes them in order. This runs while the
+ * caller fills the next batch of blocks.
+ *
+ * @param fn         BGZF output file; NULL for uncompressed stdout
+ * @param n_threads  number of compression threads
+ *
+ * @return file handler, or NULL if the file can't be created
+ */
+fm_gzw_t *fm_gzwopen(const char *fn, int n_threads);
+int fm_gzwrite(fm_gzw_t *w, const void *buf, size_t len); // thread-safe; data from one call are never interleaved
+int fm_gzwclose(fm_gzw_t *w); // flush, write the BGZF EOF marker and close; return -1 on write errors
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "kseq.h"
+#ifdef FM_SEQIO_KSEQ_IMPL // defined in seqio.c only
+KSEQ_INIT2(, fm_gzf_t*, fm_gzread)
+#else
+KSEQ_DECLARE(fm_gzf_t*)
+#endif
+
+/*******************
+ *** Read batch ***
+ *******************/
+
+typedef struct { // a batch of reads stored back to back in one arena; reused across batches
+	int n, m;
+	int *len; // sequence lengths
+	char **name, **comment, **seq, **qual; // point into buf; comment[i] and qual[i] are NULL if absent
+	uint64_t l_buf, m_buf;
+	char *buf; // NULL-terminated name, comment, sequence and quality of each read
+} fm_batch_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+fm_batch_t *fm_batch_init(void);
+void fm_batch_destroy(fm_batch_t *b);
+
+/**
+ * Read a batch of reads
+ *
+ * Memory of the previous batch in b is reused; pointers into it are
+ * invalidated.
+ *
+ * @param ks       input stream
+ * @param max_len  stop after reading at least max_len bases
+ * @param max_n    stop after reading max_n reads; no limit if <= 0
+ * @param b        batch (in/out)
+ *
+ * @return number of reads; 0 at the end of the input
+ */
+int fm_batch_read(kseq_t *ks, int64_t max_len, int max_n, fm_batch_t *b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
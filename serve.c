@@ -0,0 +1,541 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <zlib.h>
+#include "fermi2.h"
+#include "priv.h"
+#include "kvec.h"
+#include "kstring.h"
+#include "ketopt.h"
+
+#define SRV_MAX_BATCH 4096 // max number of queries processed in one go
+#define SRV_MIN_PAR   64   // use all threads if a batch has at least this many queries
+
+/* Protocol: one query per line, fields separated by TAB or SPACE. The last
+ * field is always the query sequence. Each query is answered by zero or more
+ * lines followed by a line "//".
+ *
+ *   count SEQ           CT  occurrence
+ *   locate SEQ          EM  0  len  occurrence [positions]     (requires -s)
+ *   smem SEQ            EM  start  end  occurrence [positions] (one line per SMEM)
+ *   kprof K C SEQ       KP  start  end  occurrence             (one line per window)
+ *
+ * A malformed query is answered with "ER  message".
+ */
+
+extern void seq_char2nt6(int l, unsigned char *s);
+extern int ksprintf(kstring_t *s, const char *fmt, ...);
+
+typedef struct {
+	rldintv_v curr, prev;
+	fmdsmem_v smem;
+} srvmem_t;
+
+struct srvconn_s;
+
+typedef struct { // queries [beg,end) of a batch
+	struct srvconn_s *c;
+	int beg, end;
+} srvtask_t;
+
+typedef struct {
+	int fd;
+	kstring_t in; // input not answered yet: an incomplete line
+} srvcli_t;
+
+typedef struct {
+	const rld_t *e;
+	const fmsa_t *sa;
+	int is_bidir, min_occ, max_sa_occ;
+	int n_threads, fd, pipe[2];
+	// the poller queues readable connections; a worker answers what one read() returns and hands the connection back
+	int stop, conn_beg;
+	kvec_t(srvcli_t*) conn, ret; // conn: readable, served first in first out; ret: to be polled again
+	kvec_t(srvtask_t) task; // parts of large batches, for idle workers to help with
+	pthread_mutex_t lock;
+	pthread_cond_t cv;
+} server_t;
+
+typedef struct srvconn_s {
+	server_t *s;
+	int n, n_left; // n_left: tasks of the current batch not finished; protected by s->lock
+	char **q;
+	kstring_t *out, buf;
+} srvconn_t;
+
+typedef struct {
+	server_t *s;
+	srvmem_t mem;
+	srvconn_t c;
+} srvworker_t;
+
+static void srv_locate(const server_t *s, int64_t l, int64_t occ, kstring_t *out)
+{
+	int64_t k, idx, i;
+	if (s->sa == 0 || occ > s->max_sa_occ) return;
+	for (k = l; k < l + occ; ++k) {
+		i = fm_sa(s->e, s->sa, k, &idx);
+		ksprintf(out, "\t%ld:%ld", (long)idx, (long)i);
+	}
+}
+
+static void srv_query1(const server_t *s, srvmem_t *m, char *q, kstring_t *out)
+{
+	char *p, *f[4];
+	int n_f, l_seq;
+	out->l = 0;
+	for (p = q, n_f = 0; *p && n_f < 4;) { // split into fields
+		while (*p == ' ' || *p == '\t') ++p;
+		if (*p == 0) break;
+		f[n_f++] = p;
+		while (*p && *p != ' ' && *p != '\t') ++p;
+		if (*p) *p++ = 0;
+	}
+	if (n_f < 2) {
+		kputs("ER\ttoo few fields\n", out);
+	} else if (strcmp(f[0], "count") == 0 || strcmp(f[0], "locate") == 0) {
+		int64_t l, u;
+		int is_loc = (f[0][0] == 'l');
+		if (is_loc && s->sa == 0) {
+			kputs("ER\tsampled suffix array not loaded\n", out);
+		} else {
+			fm_exact(s->e, f[1], &l, &u);
+			if (!is_loc) {
+				ksprintf(out, "CT\t%ld\n", (long)(l < u? u - l : 0));
+			} else if (l < u) {
+				ksprintf(out, "EM\t0\t%d\t%ld", (int)strlen(f[1]), (long)(u - l));
+				srv_locate(s, l, u - l, out);
+				kputc('\n', out);
+			}
+		}
+	} else if (strcmp(f[0], "smem") == 0) {
+		if (!s->is_bidir) {
+			kputs("ER\tthe index does not include both strands\n", out);
+		} else {
+			size_t i;
+			l_seq = strlen(f[1]);
+			seq_char2nt6(l_seq, (uint8_t*)f[1]);
+			fmd_smem(s->e, (uint8_t*)f[1], &m->smem, s->min_occ, &m->curr, &m->prev);
+			for (i = 0; i < m->smem.n; ++i) {
+				fmdsmem_t *r = &m->smem.a[i];
+				ksprintf(out, "EM\t%u\t%u\t%ld", (uint32_t)(r->ik.info>>32), (uint32_t)r->ik.info, (long)r->ik.x[2]);
+				srv_locate(s, r->ik.x[0], r->ik.x[2], out);
+				kputc('\n', out);
+			}
+		}
+	} else if (strcmp(f[0], "kprof") == 0) {
+		if (n_f < 4) {
+			kputs("ER\tkprof requires K and C\n", out);
+		} else {
+			int i, n_a, k = atoi(f[1]), c = atoi(f[2]);
+			fm_icnt_t *a;
+			if (k <= 0) {
+				kputs("ER\tinvalid K\n", out);
+			} else {
+				a = fm_kprof(s->e, f[3], k, c, &n_a);
+				for (i = 0; i < n_a; ++i)
+					ksprintf(out, "KP\t%d\t%d\t%d\n", a[i].st, a[i].en, a[i].occ);
+				free(a);
+			}
+		}
+	} else kputs("ER\tunknown command\n", out);
+	kputsn("//\n", 3, out);
+}
+
+static void srv_task_run(srvworker_t *w, srvtask_t *t) // call with s->lock held
+{
+	server_t *s = w->s;
+	int i;
+	pthread_mutex_unlock(&s->lock);
+	for (i = t->beg; i < t->end; ++i)
+		srv_query1(s, &w->mem, t->c->q[i], &t->c->out[i]);
+	pthread_mutex_lock(&s->lock);
+	if (--t->c->n_left == 0) pthread_cond_broadcast(&s->cv);
+}
+
+static void srv_batch(srvworker_t *w, srvconn_t *c)
+{ // answer c->q[0..c->n-1]; a large batch is split into tasks so that idle workers can help
+	server_t *s = c->s;
+	int i, n_tasks = 1, size = c->n;
+	srvtask_t t;
+	if (c->n >= SRV_MIN_PAR && s->n_threads > 1) {
+		size = (c->n + s->n_threads - 1) / s->n_threads;
+		size = size > SRV_MIN_PAR>>2? size : SRV_MIN_PAR>>2;
+		n_tasks = (c->n + size - 1) / size;
+	}
+	pthread_mutex_lock(&s->lock);
+	c->n_left = n_tasks;
+	for (i = 1; i < n_tasks; ++i) {
+		srvtask_t *p;
+		kv_pushp(srvtask_t, s->task, &p);
+		p->c = c, p->beg = i * size, p->end = (i + 1) * size < c->n? (i + 1) * size : c->n;
+	}
+	if (n_tasks > 1) pthread_cond_broadcast(&s->cv);
+	t.c = c, t.beg = 0, t.end = size < c->n? size : c->n;
+	srv_task_run(w, &t);
+	while (c->n_left > 0) { // help with queued tasks, ours or others', until our batch is done
+		if (s->task.n > 0) {
+			t = kv_pop(s->task);
+			srv_task_run(w, &t);
+		} else pthread_cond_wait(&s->cv, &s->lock);
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+static int write_all(int fd, const char *s, size_t l)
+{
+	while (l > 0) {
+		ssize_t r = write(fd, s, l);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		s += r, l -= r;
+	}
+	return 0;
+}
+
+static int srv_run(srvworker_t *w, srvconn_t *c, int fd, char *s, int l) // process lines in s[0..l-1]; s[l-1] must be '\n'
+{
+	char *p, *q, *end = s + l;
+	int i;
+	for (p = q = s, c->n = 0; p < end; ++p) {
+		char *r;
+		if (*p != '\n') continue;
+		r = p > q && p[-1] == '\r'? p - 1 : p;
+		*r = 0;
+		if (r > q) c->q[c->n++] = q;
+		q = p + 1;
+		if (c->n == SRV_MAX_BATCH || (p == end - 1 && c->n > 0)) {
+			srv_batch(w, c);
+			for (i = 0, c->buf.l = 0; i < c->n; ++i)
+				kputsn(c->out[i].s, c->out[i].l, &c->buf);
+			if (write_all(fd, c->buf.s, c->buf.l) < 0) return -1;
+			c->n = 0;
+		}
+	}
+	return 0;
+}
+
+static int srv_serve1(srvworker_t *w, srvcli_t *p) // answer the lines from one read() on a readable connection; return -1 if it is done
+{
+	char buf[0x10000];
+	ssize_t l;
+	int end;
+	do l = read(p->fd, buf, sizeof(buf)); while (l < 0 && errno == EINTR);
+	if (l <= 0) {
+		if (l == 0 && p->in.l > 0) { // the last line without a newline
+			kputc('\n', &p->in);
+			srv_run(w, &w->c, p->fd, p->in.s, p->in.l);
+		}
+		return -1;
+	}
+	kputsn(buf, l, &p->in);
+	for (end = p->in.l; end > 0 && p->in.s[end-1] != '\n'; --end);
+	if (end == 0) return 0;
+	if (srv_run(w, &w->c, p->fd, p->in.s, end) < 0) return -1;
+	memmove(p->in.s, p->in.s + end, p->in.l - end);
+	p->in.l -= end;
+	return 0;
+}
+
+static void srv_cli_close(srvcli_t *p)
+{
+	close(p->fd);
+	free(p->in.s); free(p);
+}
+
+static void srv_wake(int fd) // wake up the poller; async-signal-safe
+{
+	int e = errno;
+	if (write(fd, "", 1) < 0) {} // a full pipe will wake it up anyway
+	errno = e;
+}
+
+static void *srv_handler(void *data)
+{
+	srvworker_t *w = (srvworker_t*)data;
+	server_t *s = w->s;
+	srvconn_t *c = &w->c;
+	int i;
+	c->s = s;
+	c->q = calloc(SRV_MAX_BATCH, sizeof(char*));
+	c->out = calloc(SRV_MAX_BATCH, sizeof(kstring_t));
+	pthread_mutex_lock(&s->lock);
+	for (;;) {
+		if (s->task.n > 0) { // help other connections first
+			srvtask_t t = kv_pop(s->task);
+			srv_task_run(w, &t);
+		} else if (s->conn_beg < s->conn.n && !s->stop) {
+			srvcli_t *p = s->conn.a[s->conn_beg++];
+			int ret;
+			if (s->conn_beg == s->conn.n) s->conn_beg = s->conn.n = 0;
+			pthread_mutex_unlock(&s->lock);
+			ret = srv_serve1(w, p);
+			pthread_mutex_lock(&s->lock);
+			if (ret < 0 || s->stop) srv_cli_close(p);
+			else {
+				kv_push(srvcli_t*, s->ret, p);
+				srv_wake(s->pipe[1]);
+			}
+		} else if (s->stop) break;
+		else pthread_cond_wait(&s->cv, &s->lock);
+	}
+	pthread_mutex_unlock(&s->lock);
+	free(w->mem.curr.a); free(w->mem.prev.a); free(w->mem.smem.a);
+	for (i = 0; i < SRV_MAX_BATCH; ++i) free(c->out[i].s);
+	free(c->q); free(c->out); free(c->buf.s);
+	return 0;
+}
+
+static volatile sig_atomic_t srv_sig;
+static int srv_sig_fd = -1;
+
+static void srv_on_signal(int sig) { srv_sig = sig, srv_wake(srv_sig_fd); }
+
+static int srv_addr(const char *fn, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	if (strlen(fn) >= sizeof(addr->sun_path)) {
+		fprintf(stderr, "[E::%s] socket path too long\n", __func__);
+		return -1;
+	}
+	strcpy(addr->sun_path, fn);
+	return 0;
+}
+
+int main_serve(int argc, char *argv[])
+{
+	ketopt_t o = KETOPT_INIT;
+	int i, j, c, use_mmap = 0, fd;
+	char *fn_sa = 0, *fn_sock = 0;
+	struct sockaddr_un addr;
+	kvec_t(srvcli_t*) idle = {0,0,0}; // connections waiting for input; owned by the poller
+	kvec_t(struct pollfd) pfd = {0,0,0};
+	struct sigaction sa;
+	sigset_t mask, old_mask;
+	pthread_t *tid;
+	srvworker_t *w;
+	server_t s;
+
+	memset(&s, 0, sizeof(server_t));
+	s.n_threads = 1, s.min_occ = 1, s.max_sa_occ = 10;
+	while ((c = ketopt(&o, argc, argv, 1, "Mt:s:m:n:u:", 0)) >= 0) {
+		if (c == 'M') use_mmap = 1;
+		else if (c == 't') s.n_threads = atoi(o.arg);
+		else if (c == 's') fn_sa = o.arg;
+		else if (c == 'm') s.max_sa_occ = atoi(o.arg);
+		else if (c == 'n') s.min_occ = atoi(o.arg);
+		else if (c == 'u') fn_sock = o.arg;
+	}
+	if (argc - o.ind < 1) {
+		fprintf(stderr, "Usage: fermi2 serve [options] <index.fmd>\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -u FILE   Unix socket to listen on [<index.fmd>.sock]\n");
+		fprintf(stderr, "  -t INT    number of threads [%d]\n", s.n_threads);
+		fprintf(stderr, "  -s FILE   sampled suffix array []\n");
+		fprintf(stderr, "  -m INT    show coordinate if the number of hits is no more than INT [%d]\n", s.max_sa_occ);
+		fprintf(stderr, "  -n INT    min occurrences for SMEMs [%d]\n", s.min_occ);
+		fprintf(stderr, "  -M        load the index with mmap\n");
+		fprintf(stderr, "Queries (one per line; answered by lines ending with \"//\"):\n");
+		fprintf(stderr, "    count SEQ | locate SEQ | smem SEQ | kprof K C SEQ\n");
+		return 1;
+	}
+	if (s.n_threads < 1) s.n_threads = 1;
+
+	s.e = use_mmap? rld_restore_mmap(argv[o.ind]) : rld_restore(argv[o.ind]);
+	if (s.e == 0) {
+		fprintf(stderr, "[E::%s] failed to open the index file\n", __func__);
+		return 1;
+	}
+	s.is_bidir = (s.e->mcnt[2] == s.e->mcnt[5] && s.e->mcnt[3] == s.e->mcnt[4]);
+	if (fn_sa && (s.sa = fm_sa_restore(fn_sa)) == 0) {
+		fprintf(stderr, "[E::%s] failed to open the sampled SA file\n", __func__);
+		rld_destroy((rld_t*)s.e);
+		return 1;
+	}
+
+	if (fn_sock == 0) {
+		fn_sock = alloca(strlen(argv[o.ind]) + 6);
+		strcat(strcpy(fn_sock, argv[o.ind]), ".sock");
+	}
+	if (srv_addr(fn_sock, &addr) < 0) return 1;
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		perror("socket");
+		return 1;
+	}
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+		fprintf(stderr, "[E::%s] socket '%s' is in use by another server\n", __func__, fn_sock);
+		close(fd);
+		return 1;
+	}
+	close(fd); // the state of a socket is unspecified after a failed connect(); use a new one
+	unlink(fn_sock); // remove a stale socket, if any
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+		perror("bind");
+		if (fd >= 0) close(fd);
+		return 1;
+	}
+	s.fd = fd;
+	if (pipe(s.pipe) < 0) {
+		perror("pipe");
+		close(fd);
+		return 1;
+	}
+	for (i = 0; i < 2; ++i) fcntl(s.pipe[i], F_SETFL, fcntl(s.pipe[i], F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); // poll() may report a connection that is gone by accept()
+	srv_sig_fd = s.pipe[1];
+	signal(SIGPIPE, SIG_IGN);
+	memset(&sa, 0, sizeof(struct sigaction));
+	sa.sa_handler = srv_on_signal; // writes to the pipe, so a signal arriving before poll() is not lost
+	sigaction(SIGINT, &sa, 0);
+	sigaction(SIGTERM, &sa, 0);
+	if (fm_verbose >= 3)
+		fprintf(stderr, "[M::%s] listening on '%s' with %d threads\n", __func__, fn_sock, s.n_threads);
+
+	// start the worker pool with the signals blocked; only the poller handles them
+	pthread_mutex_init(&s.lock, 0);
+	pthread_cond_init(&s.cv, 0);
+	w = calloc(s.n_threads, sizeof(srvworker_t));
+	tid = alloca(s.n_threads * sizeof(pthread_t));
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+	for (i = 0; i < s.n_threads; ++i) {
+		w[i].s = &s;
+		pthread_create(&tid[i], 0, srv_handler, &w[i]);
+	}
+	pthread_sigmask(SIG_SETMASK, &old_mask, 0);
+
+	while (!srv_sig) { // poll the pipe, the listening socket and idle connections; readable connections go to the workers
+		int n_pfd, n_ready;
+		char tmp[256];
+		pthread_mutex_lock(&s.lock);
+		for (i = 0; i < s.ret.n; ++i) kv_push(srvcli_t*, idle, s.ret.a[i]);
+		s.ret.n = 0;
+		pthread_mutex_unlock(&s.lock);
+		n_pfd = idle.n + 2;
+		kv_resize(struct pollfd, pfd, n_pfd);
+		pfd.a[0].fd = s.pipe[0], pfd.a[1].fd = fd;
+		for (i = 0; i < idle.n; ++i) pfd.a[i+2].fd = idle.a[i]->fd;
+		for (i = 0; i < n_pfd; ++i) pfd.a[i].events = POLLIN, pfd.a[i].revents = 0;
+		if (poll(pfd.a, n_pfd, -1) < 0) {
+			if (errno == EINTR) continue;
+			perror("poll");
+			break;
+		}
+		if (pfd.a[0].revents) while (read(s.pipe[0], tmp, sizeof(tmp)) > 0);
+		pthread_mutex_lock(&s.lock);
+		for (i = j = 0; i < idle.n; ++i) {
+			if (pfd.a[i+2].revents == 0) idle.a[j++] = idle.a[i];
+			else kv_push(srvcli_t*, s.conn, idle.a[i]); // readable, closed or failed
+		}
+		n_ready = idle.n - j;
+		idle.n = j;
+		if (n_ready > 0) pthread_cond_broadcast(&s.cv); // not signal: workers waiting in srv_batch() share the cv
+		pthread_mutex_unlock(&s.lock);
+		if (pfd.a[1].revents) {
+			int cfd = accept(fd, 0, 0);
+			if (cfd >= 0) {
+				srvcli_t *p = calloc(1, sizeof(srvcli_t));
+				p->fd = cfd;
+				kv_push(srvcli_t*, idle, p);
+			} else if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN && errno != EWOULDBLOCK) {
+				perror("accept");
+				break;
+			}
+		}
+	}
+	if (fm_verbose >= 3 && srv_sig)
+		fprintf(stderr, "[M::%s] shutting down on signal %d\n", __func__, (int)srv_sig);
+
+	// stop listening and drop idle and queued connections; busy workers finish the lines they have read
+	close(fd);
+	unlink(fn_sock);
+	pthread_mutex_lock(&s.lock);
+	s.stop = 1;
+	for (i = s.conn_beg; i < s.conn.n; ++i) srv_cli_close(s.conn.a[i]);
+	for (i = 0; i < s.ret.n; ++i) srv_cli_close(s.ret.a[i]);
+	s.conn.n = s.conn_beg = s.ret.n = 0;
+	pthread_cond_broadcast(&s.cv);
+	pthread_mutex_unlock(&s.lock);
+	for (i = 0; i < s.n_threads; ++i) pthread_join(tid[i], 0);
+	for (i = 0; i < idle.n; ++i) srv_cli_close(idle.a[i]);
+	srv_sig_fd = -1;
+	close(s.pipe[0]); close(s.pipe[1]);
+
+	pthread_mutex_destroy(&s.lock);
+	pthread_cond_destroy(&s.cv);
+	free(s.conn.a); free(s.ret.a); free(s.task.a); free(idle.a); free(pfd.a); free(w);
+	if (s.sa) fm_sa_destroy((fmsa_t*)s.sa);
+	rld_destroy((rld_t*)s.e);
+	return 0;
+}
+
+/**************
+ *** Client ***
+ **************/
+
+typedef struct {
+	gzFile fp;
+	int fd;
+} client_t;
+
+static void *cli_sender(void *data)
+{
+	client_t *c = (client_t*)data;
+	char buf[0x10000];
+	int l;
+	while ((l = gzread(c->fp, buf, sizeof(buf))) > 0)
+		if (write_all(c->fd, buf, l) < 0) break;
+	shutdown(c->fd, SHUT_WR);
+	return 0;
+}
+
+int main_client(int argc, char *argv[])
+{
+	struct sockaddr_un addr;
+	char buf[0x10000];
+	pthread_t tid;
+	client_t c;
+	ssize_t l;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: fermi2 client <server.sock> [queries.txt]\n");
+		return 1;
+	}
+	if (srv_addr(argv[1], &addr) < 0) return 1;
+	c.fp = argc >= 3 && strcmp(argv[2], "-")? gzopen(argv[2], "r") : gzdopen(fileno(stdin), "r");
+	if (c.fp == 0) {
+		fprintf(stderr, "[E::%s] failed to open the query file\n", __func__);
+		return 1;
+	}
+	if ((c.fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(c.fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "[E::%s] failed to connect to '%s'\n", __func__, argv[1]);
+		gzclose(c.fp);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	pthread_create(&tid, 0, cli_sender, &c);
+	while ((l = read(c.fd, buf, sizeof(buf))) != 0) {
+		if (l < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		fwrite(buf, 1, l, stdout);
+	}
+	pthread_join(tid, 0);
+	close(c.fd);
+	gzclose(c.fp);
+	return l < 0? 1 : 0;
+}
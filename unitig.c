@@ -6,6 +6,7 @@
 #include "kstring.h"
 #include "rld0.h"
 #include "mag.h"
+#include "seqio.h"
 #include "priv.h"
 
 /******************
@@ -377,6 +378,7 @@ typedef struct {
 	uint64_t prime, *used, *bend, *visited;
 	const rld_t *e;
 	thrdat_t *d;
+	fm_gzw_t *out;
 } worker_t;
 
 static void worker(void *data, long _i, int tid)
@@ -398,11 +400,11 @@ static void worker(void *data, long _i, int tid)
 		memcpy(d->z.seq, d->str.s, d->z.len);
 		memcpy(d->z.cov, d->cov.s, d->z.len + 1);
 		mag_v_write(&d->z, &d->out);
-		fputs(d->out.s, stdout);
+		fm_gzwrite(w->out, d->out.s, d->out.l);
 	}
 }
 
-int fm6_unitig(const rld_t *e, int min_match, int min_merge_len, int n_threads)
+int fm6_unitig(const rld_t *e, int min_match, int min_merge_len, int n_threads, fm_gzw_t *out)
 {
 	extern void kt_for(int n_threads, void (*func)(void*,long,int), void *data, long n);
 	worker_t w;
@@ -411,6 +413,7 @@ int fm6_unitig(const rld_t *e, int min_match, int min_merge_len, int n_threads)
 	w.bend    = (uint64_t*)calloc((e->mcnt[1] + 63)/64, 8);
 	w.visited = (uint64_t*)calloc((e->mcnt[1] + 63)/64, 8);
 	w.e       = e;
+	w.out     = out;
 	assert(e->mcnt[1] >= n_threads * 2);
 	w.d = calloc(n_threads, sizeof(thrdat_t));
 	w.prime = 0;
@@ -438,13 +441,16 @@ int fm6_unitig(const rld_t *e, int min_match, int min_merge_len, int n_threads)
 int main_assemble(int argc, char *argv[])
 {
 	int c, use_mmap = 0, n_threads = 1, min_match = 31, min_merge_len = 0;
+	char *fn_out = 0;
 	rld_t *e;
-	while ((c = getopt(argc, argv, "Ml:t:r:m:")) >= 0) {
+	fm_gzw_t *out;
+	while ((c = getopt(argc, argv, "Ml:t:r:m:Z:")) >= 0) {
 		switch (c) {
 			case 'l': min_match = atoi(optarg); break;
 			case 'm': min_merge_len = atoi(optarg); break;
 			case 'M': use_mmap = 1; break;
 			case 't': n_threads = atoi(optarg); break;
+			case 'Z': fn_out = optarg; break;
 		}
 	}
 	if (optind + 1 > argc) {
@@ -453,11 +459,16 @@ int main_assemble(int argc, char *argv[])
 		fprintf(stderr, "Options: -l INT      min match [%d]\n", min_match);
 		fprintf(stderr, "         -m INT      min merge length [%d]\n", min_merge_len);
 		fprintf(stderr, "         -t INT      number of threads [1]\n");
+		fprintf(stderr, "         -Z FILE     write unitigs to FILE in the BGZF format [stdout]\n");
 		fprintf(stderr, "\n");
 		return 1;
 	}
+	if ((out = fm_gzwopen(fn_out, n_threads)) == 0) {
+		fprintf(stderr, "[E::%s] failed to create the output file\n", __func__);
+		return 1;
+	}
 	e = use_mmap? rld_restore_mmap(argv[optind]) : rld_restore(argv[optind]);
-	fm6_unitig(e, min_match, min_merge_len, n_threads);
+	fm6_unitig(e, min_match, min_merge_len, n_threads, out);
 	rld_destroy(e);
-	return 0;
+	return fm_gzwclose(out) < 0? 1 : 0;
 }
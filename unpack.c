@@ -1,9 +1,11 @@
 #include <stdio.h>
-#include <zlib.h>
 #include "rld0.h"
 #include "kstring.h"
-#include "kseq.h"
-KSTREAM_DECLARE(gzFile, gzread)
+#include "seqio.h"
+
+extern kstream_t *ks_init(fm_gzf_t *f);
+extern void ks_destroy(kstream_t *ks);
+extern int ks_getuntil2(kstream_t *ks, int delimiter, kstring_t *str, int *dret, int append);
 
 int64_t fm_retrieve(const rld_t *e, uint64_t x, kstring_t *s)
 {
@@ -23,13 +25,13 @@ char **hts_readlines(const char *fn, int64_t *_n)
 	int64_t m = 0, n = 0;
 	int dret;
 	char **s = 0;
-	gzFile fp;
-	if ((fp = gzopen(fn, "r")) != 0) { // read from file
+	fm_gzf_t *fp;
+	if ((fp = fm_gzopen(fn, 1)) != 0) { // read from file
 		kstream_t *ks;
 		kstring_t str;
 		str.s = 0; str.l = str.m = 0;
 		ks = ks_init(fp);
-		while (ks_getuntil(ks, KS_SEP_LINE, &str, &dret) >= 0) {
+		while (ks_getuntil2(ks, KS_SEP_LINE, &str, &dret, 0) >= 0) {
 			if (str.l == 0) continue;
 			if (m == n) {
 				m = m? m<<1 : 16;
@@ -38,9 +40,13 @@ char **hts_readlines(const char *fn, int64_t *_n)
 			s[n++] = strdup(str.s);
 		}
 		ks_destroy(ks);
-		gzclose(fp);
-		s = (char**)realloc(s, n * sizeof(void*));
 		free(str.s);
+		if (fm_gzclose(fp) < 0) {
+			while (n > 0) free(s[--n]);
+			free(s);
+			return 0;
+		}
+		s = (char**)realloc(s, n * sizeof(void*));
 	} else if (*fn == ':') { // read from string
 		const char *q, *p;
 		for (q = p = fn + 1;; ++p)